@@ -0,0 +1,319 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Bitboard.hpp"
+#include "CSVReader.hpp"
+#include "EvaluationModel.hpp"
+#include "FEN.hpp"
+#include "FixedShapeFeature.hpp"
+#include "RadixTree.hpp"
+#include "ThreadPool.hpp"
+
+// Every heap allocation in the process goes through here, so each benchmark
+// can report how many allocations one operation costs
+static std::atomic<size_t> allocation_count(0);
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+// GCC pairs the inlined std::free with the library operator new rather than
+// the replacement above and warns about a mismatch that cannot happen
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    ::operator delete(pointer);
+}
+
+namespace SyntheticPositions {
+    static constexpr size_t POSITION_COUNT_DEFAULT = 20000;
+    static constexpr float OCCUPANCY = 0.3f;
+    static constexpr char PIECES[] = "PpKkNnQqRrBb";
+
+    // Piece placement field only, the part FEN::positionStringToCharSequence
+    // reads. Same seed, same positions, so runs on different builds are comparable
+    static std::string randomFEN(Xoshiro& generator) {
+        std::string fen;
+        for (int rank = 0; rank < 8; rank++) {
+            int empty_squares = 0;
+            for (int file = 0; file < 8; file++) {
+                if (generator() >= OCCUPANCY) {
+                    empty_squares++;
+                    continue;
+                }
+                if (empty_squares > 0)
+                    fen += static_cast<char>('0' + empty_squares);
+                empty_squares = 0;
+                fen += PIECES[std::min(static_cast<int>(generator() * 12), 11)];
+            }
+            if (empty_squares > 0)
+                fen += static_cast<char>('0' + empty_squares);
+            if (rank < 7)
+                fen += '/';
+        }
+        return fen;
+    }
+
+    static std::string randomEval(Xoshiro& generator) {
+        const int centipawns = static_cast<int>(generator() * 2000.f) - 1000;
+        if (generator() < 0.02f)
+            return std::string("#") + (centipawns < 0 ? "-" : "+") + std::to_string(1 + std::abs(centipawns) % 9);
+        return (centipawns < 0 ? "" : "+") + std::to_string(centipawns);
+    }
+
+    struct Dataset {
+        std::vector<std::string> positions;
+        std::vector<std::string> evaluations;
+        std::string csv_text;
+    };
+
+    static Dataset generate(const size_t position_count, const float seed) {
+        Xoshiro generator(seed);
+        Dataset dataset;
+        dataset.csv_text = "FEN,Evaluation\n";
+        for (size_t i = 0; i < position_count; i++) {
+            dataset.positions.push_back(randomFEN(generator));
+            dataset.evaluations.push_back(randomEval(generator));
+            dataset.csv_text += dataset.positions.back() + " w - - 0 1,"
+                + dataset.evaluations.back() + "\n";
+        }
+        return dataset;
+    }
+};
+
+namespace Benchmark {
+    static constexpr double MIN_SECONDS = 0.25;
+
+    // Keeps results alive so the optimizer can't drop the measured work
+    static volatile double sink = 0.0;
+
+    // Repeats operation(), which performs items_per_call operations, until at
+    // least MIN_SECONDS have passed, then reports per operation figures.
+    // An operation given the cores it runs on also reports the rate per core
+    template <typename Operation>
+    static void run(const std::string& name, const size_t items_per_call, Operation operation,
+        const size_t core_count = 0) {
+        operation();
+        size_t call_count = 0;
+        const size_t allocations_before = allocation_count.load();
+        const auto start = std::chrono::steady_clock::now();
+        double seconds = 0.0;
+        do {
+            operation();
+            call_count++;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < MIN_SECONDS);
+        const double operation_count = static_cast<double>(call_count * items_per_call);
+        const double allocations = static_cast<double>(allocation_count.load() - allocations_before);
+
+        std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(14) << seconds * 1e9 / operation_count << " ns/op"
+            << std::setw(16) << std::setprecision(0) << operation_count / seconds << " items/s"
+            << std::setw(12) << std::setprecision(2) << allocations / operation_count << " allocs/op";
+        if (core_count > 0)
+            std::cout << std::setw(16) << std::setprecision(0) << operation_count / seconds / core_count
+                << " items/s/core";
+        std::cout << std::endl;
+    }
+
+    // Number of positions whose shared-model score differs from the serial one
+    static size_t countMismatches(const std::vector<float>& serial_scores,
+        const std::vector<float>& shared_scores) {
+        size_t mismatch_count = 0;
+        for (size_t i = 0; i < serial_scores.size(); i++)
+            mismatch_count += serial_scores[i] != shared_scores[i];
+        return mismatch_count;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    using namespace Chess;
+    const size_t position_count = argc > 1
+        ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 1)
+        : SyntheticPositions::POSITION_COUNT_DEFAULT;
+    const size_t thread_count = argc > 2
+        ? std::max<size_t>(std::strtoull(argv[2], nullptr, 10), 1)
+        : std::max(std::thread::hardware_concurrency(), 1u);
+    const SyntheticPositions::Dataset dataset = SyntheticPositions::generate(position_count, 1234876786);
+    std::cout << "Benchmarking on " << position_count << " synthetic positions" << std::endl;
+
+    Benchmark::run("CSVReader::delimit", position_count, [&]() {
+        CSVReader csv_reader(std::string_view(dataset.csv_text));
+        std::string_view header_line;
+        csv_reader.nextLine(header_line);
+        for (size_t i = 0; i < position_count; i++)
+            Benchmark::sink = Benchmark::sink + csv_reader.delimit(Chess::IO::CSV_DELIMITERS).size();
+    });
+
+    Benchmark::run("CSVReader::nextRow", position_count, [&]() {
+        CSVReader csv_reader(std::string_view(dataset.csv_text));
+        std::string_view header_line;
+        csv_reader.nextLine(header_line);
+        std::string_view FEN_string;
+        std::string_view eval_string;
+        while (csv_reader.nextRow(FEN_string, eval_string, Chess::IO::CSV_DELIMITERS))
+            Benchmark::sink = Benchmark::sink + FEN_string.size();
+    });
+
+    Benchmark::run("FEN::positionStringToCharSequence", position_count, [&]() {
+        for (const std::string& position : dataset.positions)
+            Benchmark::sink = Benchmark::sink + FEN::positionStringToCharSequence(position)[0];
+    });
+
+    Benchmark::run("FEN::evalStringToFloat", position_count, [&]() {
+        for (const std::string& evaluation : dataset.evaluations)
+            Benchmark::sink = Benchmark::sink + FEN::evalStringToFloat(evaluation);
+    });
+
+    Benchmark::run("Bitboard::fromFEN", position_count, [&]() {
+        for (const std::string& position : dataset.positions)
+            Benchmark::sink = Benchmark::sink + Bitboard::fromFEN(position).occupancy();
+    });
+
+    std::vector<ShapeFeature> boards;
+    std::vector<Bitboard> bitboards;
+    for (const std::string& position : dataset.positions) {
+        boards.emplace_back(BoardProperties::CHESS_BOARD_PROPERTIES,
+            FEN::positionStringToCharSequence(position));
+        bitboards.push_back(Bitboard::fromFEN(position));
+    }
+
+    Benchmark::run("ShapeFeature::decomposeIntoSubquadrillaterals", position_count, [&]() {
+        for (const ShapeFeature& board : boards)
+            Benchmark::sink = Benchmark::sink + board.decomposeIntoSubquadrillaterals().size();
+    });
+
+    std::vector<BoardFeature> fixed_boards;
+    for (const ShapeFeature& board : boards)
+        fixed_boards.push_back(BoardFeature::fromBoard(board.charSequence().data(), { 0, 0 }));
+    Benchmark::run("FixedShapeFeature::forEachSubrectangle", position_count, [&]() {
+        for (const BoardFeature& board : fixed_boards)
+            board.forEachSubrectangle<1, 1>([](const FixedShapeFeature<1, 1>& feature) {
+                Benchmark::sink = Benchmark::sink + feature.at(0, 0);
+            });
+    });
+
+    Benchmark::run("Bitboard::forEachFeatureKey", position_count, [&]() {
+        for (const Bitboard& board : bitboards)
+            board.forEachFeatureKey(1, 1, [](const FeatureKey key) {
+                Benchmark::sink = Benchmark::sink + static_cast<double>(key & 1);
+            });
+    });
+
+    Benchmark::run("Bitboard::forEachFeatureKey 8x8", position_count, [&]() {
+        for (const Bitboard& board : bitboards)
+            board.forEachFeatureKey(8, 8, [](const FeatureKey key) {
+                Benchmark::sink = Benchmark::sink + static_cast<double>(key & 1);
+            });
+    });
+
+    std::vector<std::string> feature_strings;
+    for (const ShapeFeature& board : boards)
+        for (const ShapeFeature& feature : board.decomposeIntoSubquadrillaterals(2, 2))
+            feature_strings.push_back(Utility::charVectorToString(feature.charSequence()));
+
+    Benchmark::run("RadixTree::insert", feature_strings.size(), [&]() {
+        RadixTree radix_tree;
+        for (size_t i = 0; i < feature_strings.size(); i++)
+            radix_tree.insert(feature_strings[i], i);
+    });
+
+    RadixTree radix_tree;
+    for (size_t i = 0; i < feature_strings.size(); i++)
+        radix_tree.insert(feature_strings[i], i);
+    Benchmark::run("RadixTree::search", feature_strings.size(), [&]() {
+        for (const std::string& feature_string : feature_strings)
+            Benchmark::sink = Benchmark::sink + radix_tree.search(feature_string).second;
+    });
+
+    EvaluationModel model;
+    model.minFeatureCount(1);
+    std::vector<FeatureKey> feature_keys;
+    for (size_t i = 0; i < position_count; i++) {
+        feature_keys.clear();
+        bitboards[i].forEachFeatureKey(1, 1,
+            [&feature_keys](const FeatureKey key) { feature_keys.push_back(key); });
+        model.addParentFeatureKeys(FEN::evalStringToFloat(dataset.evaluations[i]),
+            feature_keys.data(), feature_keys.size());
+    }
+    model.pruneRareFeatures();
+    model.buildFeatureParentsMap();
+    model.resetCachedScores();
+
+    Benchmark::run("EvaluationModel::calculateAllErrors", 1, [&]() {
+        Benchmark::sink = Benchmark::sink + model.calculateAllErrors();
+    });
+
+    Benchmark::run("EvaluationModel::performWeightMutationsAndSetIfBest", 1, [&]() {
+        Benchmark::sink = Benchmark::sink + model.performWeightMutationsAndSetIfBest();
+    });
+
+    Benchmark::run("EvaluationModel::scoreHiddenParentShapeFeature", position_count, [&]() {
+        for (const ShapeFeature& board : boards)
+            Benchmark::sink = Benchmark::sink + model.scoreHiddenParentShapeFeature(board);
+    });
+
+    model.quantizedScoring(true);
+    Benchmark::run("EvaluationModel::calculateAllErrors quantized", 1, [&]() {
+        Benchmark::sink = Benchmark::sink + model.calculateAllErrors();
+    });
+    model.quantizedScoring(false);
+
+    FrozenModel frozen_model = model.freeze();
+    std::vector<std::string_view> positions(dataset.positions.begin(), dataset.positions.end());
+    std::vector<float> scores(position_count);
+    Benchmark::run("FrozenModel::scoreBatch", position_count, [&]() {
+        frozen_model.scoreBatch(positions.data(), positions.size(), scores.data());
+        Benchmark::sink = Benchmark::sink + scores[0];
+    });
+
+    // Every thread scores its own slice of the positions through the same
+    // const frozen model
+    ThreadPool thread_pool(thread_count);
+    std::vector<float> shared_scores(position_count);
+    const auto scoreShared = [&]() {
+        thread_pool.parallelFor(thread_count, [&](const size_t slice) {
+            const size_t begin = positions.size() * slice / thread_count;
+            const size_t end = positions.size() * (slice + 1) / thread_count;
+            frozen_model.scoreBatch(positions.data() + begin, end - begin, shared_scores.data() + begin);
+        });
+        Benchmark::sink = Benchmark::sink + shared_scores[0];
+    };
+    const std::string shared_name = "FrozenModel::scoreBatch, threads: " + std::to_string(thread_count);
+    const size_t core_count = std::min<size_t>(thread_count,
+        std::max(std::thread::hardware_concurrency(), 1u));
+    Benchmark::run(shared_name, position_count, scoreShared, core_count);
+    size_t mismatch_count = Benchmark::countMismatches(scores, shared_scores);
+
+    frozen_model.quantize();
+    Benchmark::run("FrozenModel::scoreBatch quantized", position_count, [&]() {
+        frozen_model.scoreBatch(positions.data(), positions.size(), scores.data());
+        Benchmark::sink = Benchmark::sink + scores[0];
+    });
+    Benchmark::run(shared_name + " quantized", position_count, scoreShared, core_count);
+    mismatch_count += Benchmark::countMismatches(scores, shared_scores);
+
+    if (mismatch_count > 0) {
+        std::cout << mismatch_count << " scores from the shared model differ from the serial ones" << std::endl;
+        return 1;
+    }
+    return 0;
+}
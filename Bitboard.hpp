@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "FeatureKey.hpp"
+#include "GatherKernel.hpp"
+#include "GeometricProperties.hpp"
+#include "Defs.hpp"
+
+// A board as one bitboard per piece type, square = rank * 8 + file as in
+// FEN::positionStringToCharSequence. Alongside them it keeps four bit planes,
+// plane b holding bit b of every square's 4-bit piece code, so the codes of
+// any rectangle can be pulled out with one pext per plane
+class Bitboard {
+public:
+    static constexpr size_t PIECE_TYPE_COUNT = 12;
+    static constexpr size_t CODE_PLANE_COUNT = 4;
+    static constexpr size_t SQUARE_COUNT = 64;
+
+    Bitboard() :
+        m_pieces{},
+        m_code_planes{}
+    {}
+
+    // Reads the piece placement field, anything after it is ignored
+    static Bitboard fromFEN(std::string_view fen) {
+        Bitboard board;
+        int rank = 7, file = 0;
+        for (const char c : fen) {
+            if (c == ' ')
+                break;
+            if (c == '/') {
+                rank--;
+                file = 0;
+            }
+            else if (c >= '0' && c <= '9') {
+                file += c - '0';
+            }
+            else {
+                if (rank >= 0 && file < 8)
+                    board.setPiece(static_cast<size_t>(rank * 8 + file),
+                        Chess::LookupTables::PIECE_CODE(c));
+                file++;
+            }
+        }
+        return board;
+    }
+
+    void setPiece(const size_t square, const uint8_t piece_code) {
+        if (piece_code == 0)
+            return;
+        const uint64_t square_bit = 1ull << square;
+        m_pieces[piece_code - 1] |= square_bit;
+        for (size_t plane = 0; plane < CODE_PLANE_COUNT; plane++)
+            m_code_planes[plane] |= square_bit & (0 - static_cast<uint64_t>((piece_code >> plane) & 1));
+    }
+
+    uint64_t pieces(const uint8_t piece_code) const {
+        return m_pieces[piece_code - 1];
+    }
+
+    uint64_t occupancy() const {
+        return m_code_planes[0] | m_code_planes[1] | m_code_planes[2] | m_code_planes[3];
+    }
+
+    uint8_t pieceCode(const size_t square) const {
+        uint8_t piece_code = 0;
+        for (size_t plane = 0; plane < CODE_PLANE_COUNT; plane++)
+            piece_code |= static_cast<uint8_t>(((m_code_planes[plane] >> square) & 1) << plane);
+        return piece_code;
+    }
+
+    std::vector<char> toCharSequence() const {
+        std::vector<char> char_sequence(SQUARE_COUNT);
+        for (size_t square = 0; square < SQUARE_COUNT; square++)
+            char_sequence[square] = Chess::LookupTables::CODE_TO_PIECE[pieceCode(square)];
+        return char_sequence;
+    }
+
+    // Ranks offset_x .. offset_x + width - 1 and files offset_y .. offset_y + height - 1,
+    // the squares decomposeIntoSubquadrillaterals reads for the same geometry
+    static constexpr uint64_t rectangleMask(const size_t width, const size_t height,
+        const size_t offset_x, const size_t offset_y) {
+        const uint64_t file_mask = ((1ull << height) - 1) << offset_y;
+        uint64_t mask = 0;
+        for (size_t rank = offset_x; rank < offset_x + width; rank++)
+            mask |= file_mask << (rank * 8);
+        return mask;
+    }
+
+    bool isEmpty(const uint64_t mask) const {
+        return (occupancy() & mask) == 0;
+    }
+
+    // Same key as ShapeFeature::packedKey for the matching subrectangle
+    FeatureKey featureKey(const size_t width, const size_t height,
+        const size_t offset_x, const size_t offset_y) const {
+        const FeatureKey header_bits = FeatureKeys::header(
+            GeometricProperties::ShapeType::RECTANGLE, width, height, offset_x, offset_y);
+
+        if (width * height <= FeatureKeys::MAX_EXACT_SQUARES)
+            return exactKey(header_bits, rectangleMask(width, height, offset_x, offset_y),
+                width * height);
+
+        uint64_t content_hash = 0;
+        uint64_t row_power = 1;
+        for (size_t i = 0; i < width; i++) {
+            uint64_t power = row_power;
+            for (size_t j = 0; j < height; j++) {
+                content_hash += pieceCode((offset_x + i) * 8 + offset_y + j) * power;
+                power *= FeatureKeys::COLUMN_BASE;
+            }
+            row_power *= FeatureKeys::ROW_BASE;
+        }
+        return FeatureKeys::fromContentHash(header_bits, content_hash);
+    }
+
+    // Calls callback(key) for every non-empty subrectangle of at most
+    // max_width ranks by max_height files, except the whole board, in the
+    // order of ShapeFeature::decomposeIntoSubquadrillaterals. Emptiness is one
+    // AND against a precomputed mask. Large features get their hash in O(1)
+    // from a 2D prefix sum of code * ROW_BASE^rank * COLUMN_BASE^file, shifted
+    // back to the rectangle's corner by the inverse powers
+    template <typename Callback>
+    void forEachFeatureKey(const size_t max_width, const size_t max_height,
+        Callback callback) const {
+        const bool needs_hashes = max_width * max_height > FeatureKeys::MAX_EXACT_SQUARES;
+        PrefixHashes hashes;
+        if (needs_hashes)
+            buildPrefixHashes(hashes);
+
+        forEachPlacement(max_width, max_height,
+            [this, &hashes, &callback](const size_t w, const size_t h, const size_t x1,
+                const size_t y1, const uint64_t* masks) {
+                callback(placementKey(hashes, w, h, x1, y1, masks));
+            });
+    }
+
+    // forEachFeatureKey with features that the evaluation treats alike
+    // sharing one key. Mirroring the files leaves the evaluation as it is,
+    // swapping the colours and mirroring the ranks negates it. Of the four
+    // images of a feature the smallest key stands for all of them, with
+    // FeatureKeys::NEGATED_FLAG set when it is one of the colour swapped
+    // ones. A feature that is its own colour swapped image could only ever
+    // weigh 0 and is skipped
+    template <typename Callback>
+    void forEachSymmetricFeatureKey(const size_t max_width, const size_t max_height,
+        Callback callback) const {
+        using namespace Chess::BoardProperties;
+        const Bitboard swapped = transformed(SWAPPED_RANKS, true);
+        const Bitboard images[4] = { *this, transformed(MIRRORED_FILES, false),
+            swapped, swapped.transformed(MIRRORED_FILES, false) };
+        const bool needs_hashes = max_width * max_height > FeatureKeys::MAX_EXACT_SQUARES;
+        PrefixHashes hashes[4];
+        if (needs_hashes)
+            for (size_t i = 0; i < 4; i++)
+                images[i].buildPrefixHashes(hashes[i]);
+
+        forEachPlacement(max_width, max_height,
+            [&images, &hashes, &callback](const size_t w, const size_t h, const size_t x1,
+                const size_t y1, const uint64_t* masks) {
+                const size_t mirrored_y = CHESS_BOARD_HEIGHT - h - y1;
+                const size_t swapped_x = CHESS_BOARD_WIDTH - w - x1;
+                const FeatureKey same = std::min(
+                    images[0].placementKey(hashes[0], w, h, x1, y1, masks),
+                    images[1].placementKey(hashes[1], w, h, x1, mirrored_y, masks));
+                const FeatureKey negated = std::min(
+                    images[2].placementKey(hashes[2], w, h, swapped_x, y1, masks),
+                    images[3].placementKey(hashes[3], w, h, swapped_x, mirrored_y, masks));
+                if (same == negated)
+                    return;
+                callback(same < negated ? same : negated | FeatureKeys::NEGATED_FLAG);
+            });
+    }
+
+    // The board with square s moved to s ^ square_flip, and white and black
+    // pieces swapped if swap_colours is set
+    Bitboard transformed(const size_t square_flip, const bool swap_colours) const {
+        Bitboard image;
+        for (size_t square = 0; square < SQUARE_COUNT; square++) {
+            const uint8_t piece_code = pieceCode(square);
+            if (piece_code != 0)
+                image.setPiece(square ^ square_flip,
+                    swap_colours ? static_cast<uint8_t>(((piece_code - 1) ^ 1) + 1) : piece_code);
+        }
+        return image;
+    }
+
+    // Square flips for transformed
+    static constexpr size_t SWAPPED_RANKS = 56;
+    static constexpr size_t MIRRORED_FILES = 7;
+
+private:
+    static constexpr uint64_t NIBBLE_LOW_BITS = 0x1111111111111111ull;
+
+    // 2D prefix sum of code * ROW_BASE^rank * COLUMN_BASE^file and the inverse
+    // powers that shift a rectangle's sum back to its corner
+    struct PrefixHashes {
+        uint64_t sums[9][9] = {};
+        uint64_t row_inverse_powers[8];
+        uint64_t column_inverse_powers[8];
+    };
+
+    // Calls placement(w, h, x1, y1, masks) for every placement that
+    // forEachFeatureKey keys, in its order. masks are rectangleMasks(w, h)
+    template <typename Placement>
+    void forEachPlacement(const size_t max_width, const size_t max_height,
+        Placement placement) const {
+        using namespace Chess::BoardProperties;
+        const uint64_t occupied = occupancy();
+
+        for (size_t w = CHESS_BOARD_WIDTH; w >= 1; --w) {
+            for (size_t h = CHESS_BOARD_HEIGHT; h >= 1; --h) {
+                if (w > max_width || h > max_height
+                    || (w == CHESS_BOARD_WIDTH && h == CHESS_BOARD_HEIGHT)) // Exclude self
+                    continue;
+                const uint64_t* masks = rectangleMasks(w, h);
+
+                for (size_t y1 = 0; y1 <= CHESS_BOARD_HEIGHT - h; ++y1)
+                    for (size_t x1 = 0; x1 <= CHESS_BOARD_WIDTH - w; ++x1)
+                        if ((occupied & masks[x1 * CHESS_BOARD_HEIGHT + y1]) != 0)
+                            placement(w, h, x1, y1, masks);
+            }
+        }
+    }
+
+    FeatureKey placementKey(const PrefixHashes& hashes, const size_t w, const size_t h,
+        const size_t x1, const size_t y1, const uint64_t* masks) const {
+        using namespace Chess::BoardProperties;
+        const FeatureKey header_bits = FeatureKeys::header(
+            GeometricProperties::ShapeType::RECTANGLE, w, h, x1, y1);
+        if (w * h <= FeatureKeys::MAX_EXACT_SQUARES)
+            return exactKey(header_bits, masks[x1 * CHESS_BOARD_HEIGHT + y1], w * h);
+
+        const uint64_t content_hash = (hashes.sums[x1 + w][y1 + h]
+            - hashes.sums[x1][y1 + h] - hashes.sums[x1 + w][y1] + hashes.sums[x1][y1])
+            * hashes.row_inverse_powers[x1] * hashes.column_inverse_powers[y1];
+        return FeatureKeys::fromContentHash(header_bits, content_hash);
+    }
+
+
+    // Masks of every placement of a width x height rectangle, indexed by
+    // offset_x * 8 + offset_y, built on first use
+    static const uint64_t* rectangleMasks(const size_t width, const size_t height) {
+        static const std::vector<uint64_t> masks = []() {
+            std::vector<uint64_t> all_masks(SQUARE_COUNT * SQUARE_COUNT, 0);
+            for (size_t w = 1; w <= 8; w++)
+                for (size_t h = 1; h <= 8; h++)
+                    for (size_t x = 0; x + w <= 8; x++)
+                        for (size_t y = 0; y + h <= 8; y++)
+                            all_masks[((w - 1) * 8 + h - 1) * SQUARE_COUNT + x * 8 + y]
+                                = rectangleMask(w, h, x, y);
+            return all_masks;
+        }();
+        return masks.data() + ((width - 1) * 8 + height - 1) * SQUARE_COUNT;
+    }
+
+    FeatureKey exactKey(const FeatureKey header_bits, const uint64_t mask,
+        const size_t area) const {
+        static const bool use_bmi2 = CpuFeatures::hasBmi2();
+        const uint64_t nibble_mask = NIBBLE_LOW_BITS & ((1ull << (area * 4)) - 1);
+        uint64_t content = 0;
+        for (size_t plane = 0; plane < CODE_PLANE_COUNT; plane++) {
+            content |= (use_bmi2
+                ? spreadBitsBmi2(m_code_planes[plane], mask, nibble_mask)
+                : spreadBits(m_code_planes[plane], mask, nibble_mask)) << plane;
+        }
+        return header_bits | (content << FeatureKeys::CONTENT_SHIFT);
+    }
+
+    void buildPrefixHashes(PrefixHashes& hashes) const {
+        uint64_t (&prefix_hashes)[9][9] = hashes.sums;
+        uint64_t (&row_inverse_powers)[8] = hashes.row_inverse_powers;
+        uint64_t (&column_inverse_powers)[8] = hashes.column_inverse_powers;
+        uint64_t row_power = 1;
+        row_inverse_powers[0] = column_inverse_powers[0] = 1;
+        for (size_t i = 1; i < 8; i++) {
+            row_inverse_powers[i] = row_inverse_powers[i - 1] * FeatureKeys::ROW_BASE_INVERSE;
+            column_inverse_powers[i]
+                = column_inverse_powers[i - 1] * FeatureKeys::COLUMN_BASE_INVERSE;
+        }
+        for (size_t rank = 0; rank < 8; rank++) {
+            uint64_t power = row_power;
+            for (size_t file = 0; file < 8; file++) {
+                prefix_hashes[rank + 1][file + 1] = pieceCode(rank * 8 + file) * power
+                    + prefix_hashes[rank][file + 1] + prefix_hashes[rank + 1][file]
+                    - prefix_hashes[rank][file];
+                power *= FeatureKeys::COLUMN_BASE;
+            }
+            row_power *= FeatureKeys::ROW_BASE;
+        }
+    }
+
+    // Portable pext(source, mask) followed by pdep(bits, nibble_mask)
+    static uint64_t spreadBits(const uint64_t source, uint64_t mask, uint64_t nibble_mask) {
+        uint64_t result = 0;
+        while (mask != 0) {
+            const uint64_t lowest_square = mask & (~mask + 1);
+            const uint64_t lowest_nibble = nibble_mask & (~nibble_mask + 1);
+            if (source & lowest_square)
+                result |= lowest_nibble;
+            mask ^= lowest_square;
+            nibble_mask ^= lowest_nibble;
+        }
+        return result;
+    }
+
+#ifdef ATOMIZER_X86
+    ATOMIZER_TARGET("bmi2")
+    static uint64_t spreadBitsBmi2(const uint64_t source, const uint64_t mask,
+        const uint64_t nibble_mask) {
+        return _pdep_u64(_pext_u64(source, mask), nibble_mask);
+    }
+#else
+    static uint64_t spreadBitsBmi2(const uint64_t source, const uint64_t mask,
+        const uint64_t nibble_mask) {
+        return spreadBits(source, mask, nibble_mask);
+    }
+#endif
+
+    uint64_t m_pieces[PIECE_TYPE_COUNT];
+    uint64_t m_code_planes[CODE_PLANE_COUNT];
+};
@@ -1,60 +1,149 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "MappedFile.hpp"
 
+// Walks a memory mapped CSV file line by line, handing out views into the
+// mapping so that no row needs a heap allocation
 class CSVReader {
 public:
-    CSVReader(const std::string& filename) {
-        m_file.open(filename);
-        if (!m_file.is_open()) {
+    CSVReader(const std::string& filename) :
+        m_file(filename),
+        m_text(m_file.view()),
+        m_cursor(0),
+        m_rows_read(0)
+    {
+        if (!m_file.isOpen()) {
             std::cout << "Failed to open the file." << std::endl;
         }
     }
 
-    ~CSVReader() {
-        if (m_file.is_open()) {
-            m_file.close();
-        }
+    CSVReader(const char* filename) :
+        CSVReader(std::string(filename))
+    {}
+
+    // Reads from a range of text owned by someone else, e.g. one chunk of a mapping
+    CSVReader(std::string_view text) :
+        m_text(text),
+        m_cursor(0),
+        m_rows_read(0)
+    {}
+
+    std::string_view text() const {
+        return m_text;
     }
 
-    std::vector<std::string> delimit(const char* delimiters) {
-        std::vector<std::string> parsedData;
-        std::string line;
+    bool nextLine(std::string_view& line) {
+        if (m_cursor >= m_text.size())
+            return false;
 
-        if (std::getline(m_file, line)) {
-            std::istringstream ss(line);
-            std::string token;
+        const char* begin = m_text.data() + m_cursor;
+        const size_t remaining = m_text.size() - m_cursor;
+        const char* end = static_cast<const char*>(std::memchr(begin, '\n', remaining));
+        const size_t length = end ? static_cast<size_t>(end - begin) : remaining;
 
-            while (std::getline(ss, token)) {
-                size_t pos = 0;
-                std::string delimiter;
+        m_cursor += length + 1;
+        line = std::string_view(begin, length);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        m_rows_read++;
+        return true;
+    }
 
-                while (pos != std::string::npos) {
-                    pos = token.find_first_of(delimiters);
-                    std::string tokenPart = token.substr(0, pos);
+    // Gives the first and last non-empty fields of the next line
+    bool nextRow(std::string_view& first_field, std::string_view& last_field,
+        std::string_view delimiters) {
+        std::string_view line;
+        if (!nextLine(line))
+            return false;
+        firstAndLastField(line, delimiters, first_field, last_field);
+        return true;
+    }
 
-                    if (!tokenPart.empty()) {
-                        parsedData.push_back(tokenPart);
-                    }
+    static void firstAndLastField(std::string_view line, std::string_view delimiters,
+        std::string_view& first_field, std::string_view& last_field) {
+        const size_t first_begin = line.find_first_not_of(delimiters);
+        if (first_begin == std::string_view::npos) {
+            first_field = last_field = std::string_view();
+            return;
+        }
+        const size_t first_end = line.find_first_of(delimiters, first_begin);
+        first_field = line.substr(first_begin, first_end - first_begin);
 
-                    if (pos != std::string::npos) {
-                        delimiter = token[pos];
-                        token.erase(0, pos + 1);
-                    }
-                }
+        const size_t last_end = line.find_last_not_of(delimiters) + 1;
+        const size_t last_begin = line.find_last_of(delimiters, last_end - 1);
+        last_field = last_begin == std::string_view::npos
+            ? line.substr(0, last_end)
+            : line.substr(last_begin + 1, last_end - last_begin - 1);
+    }
 
-                if (!token.empty()) {
-                    parsedData.push_back(token);
-                }
+    // Splits the next line into owned strings, kept for callers that need every column
+    std::vector<std::string> delimit(std::string_view delimiters) {
+        std::vector<std::string> parsedData;
+        std::string_view line;
+
+        if (nextLine(line)) {
+            size_t pos = line.find_first_not_of(delimiters);
+            while (pos != std::string_view::npos) {
+                const size_t end = line.find_first_of(delimiters, pos);
+                parsedData.emplace_back(line.substr(pos, end - pos));
+                pos = line.find_first_not_of(delimiters, end);
             }
         }
 
         return parsedData;
     }
 
+    size_t rowsRead() const {
+        return m_rows_read;
+    }
+
+    size_t bytesRead() const {
+        return std::min(m_cursor, m_text.size());
+    }
+
+    // Byte length of the first row_count lines of text, including their line breaks
+    static size_t lengthOfRows(std::string_view text, const size_t row_count) {
+        size_t length = 0;
+        for (size_t row = 0; row < row_count && length < text.size(); row++) {
+            const char* end = static_cast<const char*>(
+                std::memchr(text.data() + length, '\n', text.size() - length));
+            length = end ? static_cast<size_t>(end - text.data()) + 1 : text.size();
+        }
+        return length;
+    }
+
+    // Cuts text into roughly equal ranges that each start and end on a line boundary
+    static std::vector<std::string_view> splitIntoChunks(std::string_view text,
+        const size_t chunk_count) {
+        std::vector<std::string_view> chunks;
+        size_t begin = 0;
+        for (size_t i = 1; i <= chunk_count && begin < text.size(); i++) {
+            size_t end = text.size() * i / chunk_count;
+            if (end <= begin)
+                continue;
+            const size_t line_break = text.find('\n', end - 1);
+            end = line_break == std::string_view::npos ? text.size() : line_break + 1;
+            chunks.push_back(text.substr(begin, end - begin));
+            begin = end;
+        }
+        return chunks;
+    }
+
+    void printThroughput(const double seconds) const {
+        const double megabytes = bytesRead() / (1024.0 * 1024.0);
+        std::cout << "Ingested " << m_rows_read << " rows (" << megabytes << " MB) in "
+            << seconds << "s: " << m_rows_read / seconds << " rows/s, "
+            << megabytes / seconds << " MB/s" << std::endl;
+    }
+
 private:
-    std::ifstream m_file;
-};
\ No newline at end of file
+    MappedFile m_file;
+    std::string_view m_text;
+    size_t m_cursor;
+    size_t m_rows_read;
+};
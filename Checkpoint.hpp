@@ -0,0 +1,191 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Xoshiro.hpp"
+#include "FeatureKey.hpp"
+
+// Training state at the end of a round, enough to carry on exactly where a
+// run stopped. Weights are only meaningful for the same features, so the
+// checkpoint keeps a fingerprint of the feature keys rather than the keys
+struct Checkpoint {
+    uint64_t round = 0;
+    uint64_t key_fingerprint = 0;
+    double least_error = 0.0;
+    float mutation_frequency = 0.f;
+    float mutation_magnitude = 0.f;
+    Xoshiro::State rng_state{};
+    std::vector<Xoshiro::State> island_rng_states;
+    std::vector<float> weights;
+};
+
+namespace Checkpoints {
+    static constexpr char MAGIC[8] = { 'A', 'T', 'M', 'Z', 'C', 'K', 'P', 'T' };
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t island_count;
+        uint64_t round;
+        uint64_t weight_count;
+        uint64_t key_fingerprint;
+        double least_error;
+        float mutation_frequency;
+        float mutation_magnitude;
+        uint64_t rng_state[4];
+    };
+
+    static_assert(sizeof(Header) == 88, "Header layout is part of the file format");
+
+    // Order dependent, since weights are stored by feature index
+    static uint64_t fingerprint(const std::vector<FeatureKey>& feature_keys) {
+        uint64_t result = feature_keys.size();
+        for (const FeatureKey key : feature_keys)
+            result = FeatureKeys::mix(result ^ key);
+        return result;
+    }
+
+    // Written to a temporary file and renamed over the old checkpoint, so a
+    // crash mid write leaves the previous one intact
+    static bool write(const Checkpoint& checkpoint, const std::string& filename) {
+        const std::string temporary_filename = filename + ".tmp";
+        std::ofstream output(temporary_filename, std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            std::cout << "Unable to open the file: " << temporary_filename << std::endl;
+            return false;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.island_count = static_cast<uint32_t>(checkpoint.island_rng_states.size());
+        header.round = checkpoint.round;
+        header.weight_count = checkpoint.weights.size();
+        header.key_fingerprint = checkpoint.key_fingerprint;
+        header.least_error = checkpoint.least_error;
+        header.mutation_frequency = checkpoint.mutation_frequency;
+        header.mutation_magnitude = checkpoint.mutation_magnitude;
+        std::memcpy(header.rng_state, checkpoint.rng_state.data(), sizeof(header.rng_state));
+
+        output.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        output.write(reinterpret_cast<const char*>(checkpoint.island_rng_states.data()),
+            checkpoint.island_rng_states.size() * sizeof(Xoshiro::State));
+        output.write(reinterpret_cast<const char*>(checkpoint.weights.data()),
+            checkpoint.weights.size() * sizeof(float));
+        output.close();
+        if (!output)
+            return false;
+
+        std::error_code error;
+        std::filesystem::rename(temporary_filename, filename, error);
+        return !error;
+    }
+
+    // Only takes a checkpoint of weight_count weights, and checks the file
+    // holds exactly what its header says before allocating any of it
+    static bool read(const std::string& filename, Checkpoint& checkpoint, const size_t weight_count) {
+        std::ifstream input(filename, std::ios::binary);
+        if (!input.is_open())
+            return false;
+
+        Header header;
+        if (!input.read(reinterpret_cast<char*>(&header), sizeof(Header))
+            || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION)
+            return false;
+        if (header.weight_count != weight_count) {
+            std::cout << "Ignoring " << filename
+                << ": it was written for a different set of features" << std::endl;
+            return false;
+        }
+        std::error_code error;
+        const uintmax_t file_size = std::filesystem::file_size(filename, error);
+        if (error || file_size != sizeof(Header) + header.island_count * sizeof(Xoshiro::State)
+            + header.weight_count * sizeof(float)) {
+            std::cout << "Ignoring " << filename << ": it is not as long as its header says" << std::endl;
+            return false;
+        }
+
+        checkpoint.round = header.round;
+        checkpoint.key_fingerprint = header.key_fingerprint;
+        checkpoint.least_error = header.least_error;
+        checkpoint.mutation_frequency = header.mutation_frequency;
+        checkpoint.mutation_magnitude = header.mutation_magnitude;
+        std::memcpy(checkpoint.rng_state.data(), header.rng_state, sizeof(header.rng_state));
+        checkpoint.island_rng_states.resize(header.island_count);
+        checkpoint.weights.resize(static_cast<size_t>(header.weight_count));
+        input.read(reinterpret_cast<char*>(checkpoint.island_rng_states.data()),
+            checkpoint.island_rng_states.size() * sizeof(Xoshiro::State));
+        input.read(reinterpret_cast<char*>(checkpoint.weights.data()),
+            checkpoint.weights.size() * sizeof(float));
+        return static_cast<bool>(input);
+    }
+};
+
+// Writes checkpoints on its own thread. submit only swaps the snapshot in, so
+// the training loop never waits on the disk. If a write is still running the
+// newer snapshot replaces any older one that hasn't been started
+class CheckpointWriter {
+public:
+    CheckpointWriter(const std::string& filename) :
+        m_filename(filename),
+        m_has_pending(false),
+        m_stopping(false),
+        m_writer([this]() { writerLoop(); })
+    {}
+
+    // Finishes the last submitted checkpoint before returning
+    ~CheckpointWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_pending_ready.notify_one();
+        m_writer.join();
+    }
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    void submit(Checkpoint&& checkpoint) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending = std::move(checkpoint);
+            m_has_pending = true;
+        }
+        m_pending_ready.notify_one();
+    }
+
+private:
+    void writerLoop() {
+        Checkpoint checkpoint;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_pending_ready.wait(lock, [this]() { return m_has_pending || m_stopping; });
+                if (!m_has_pending)
+                    return;
+                checkpoint = std::move(m_pending);
+                m_has_pending = false;
+            }
+            if (!Checkpoints::write(checkpoint, m_filename))
+                std::cout << "Unable to write the checkpoint: " << m_filename << std::endl;
+        }
+    }
+
+    std::string m_filename;
+    std::mutex m_mutex;
+    std::condition_variable m_pending_ready;
+    Checkpoint m_pending;
+    bool m_has_pending;
+    bool m_stopping;
+    std::thread m_writer;
+};
@@ -1,39 +1,261 @@
 #pragma once
+#include <chrono>
+#include <filesystem>
+#include <thread>
 #include <vector>
 #include <string>
+#include <string_view>
 #include "CSVReader.hpp"
+#include "Bitboard.hpp"
+#include "DatasetCache.hpp"
 #include "FEN.hpp"
 #include "EvaluationModel.hpp"
+#include "Telemetry.hpp"
 #include "Defs.hpp"
 
 namespace ChessManager {
-    static void init() {
+    // More chunks than threads so a slow chunk doesn't leave the others idle
+    static constexpr size_t CHUNKS_PER_THREAD = 8;
+
+    // Feature keys of every parent in one flat array, parent i owning
+    // feature_keys[key_offsets[i] .. key_offsets[i + 1])
+    struct DecomposedChunk {
+        std::vector<float> known_evaluation_scores;
+        std::vector<FeatureKey> feature_keys;
+        std::vector<size_t> key_offsets{ 0 };
+    };
+
+    // Largest feature, in ranks by files, that boards are decomposed into,
+    // and whether symmetric features share their keys
+    struct FeatureLimits {
+        size_t max_width;
+        size_t max_height;
+        bool symmetric;
+    };
+
+    static FeatureLimits featureLimits(const EvaluationModel& model) {
+        return { model.maxFeatureWidth(), model.maxFeatureHeight(), model.hasSymmetricFeatures() };
+    }
+
+    template <typename Callback>
+    static void forEachFeatureKey(const Bitboard& board, const FeatureLimits limits,
+        Callback callback) {
+        if (limits.symmetric)
+            board.forEachSymmetricFeatureKey(limits.max_width, limits.max_height, callback);
+        else
+            board.forEachFeatureKey(limits.max_width, limits.max_height, callback);
+    }
+
+    // Features one board decomposes into, one per placement of each rectangle
+    static size_t featuresPerBoard(const FeatureLimits limits) {
+        size_t feature_count = 0;
+        for (size_t width = 1; width <= limits.max_width; width++)
+            for (size_t height = 1; height <= limits.max_height; height++)
+                if (width < 8 || height < 8)
+                    feature_count += (9 - width) * (9 - height);
+        return feature_count;
+    }
+
+    static void decomposeBoard(const Bitboard& board, const float known_evaluation_score,
+        const FeatureLimits limits, DecomposedChunk& chunk) {
+        forEachFeatureKey(board, limits, [&chunk](const FeatureKey key) {
+            chunk.feature_keys.push_back(key);
+        });
+        chunk.known_evaluation_scores.push_back(known_evaluation_score);
+        chunk.key_offsets.push_back(chunk.feature_keys.size());
+    }
+
+    static void decomposeChunk(std::string_view text, const FeatureLimits limits,
+        DecomposedChunk& chunk) {
+        using namespace Chess::IO;
+        using namespace Chess;
+        CSVReader csv_reader(text);
+        std::string_view FEN_string;
+        std::string_view eval_string;
+
+        while (csv_reader.nextRow(FEN_string, eval_string, CSV_DELIMITERS)) {
+            if (FEN_string.empty())
+                continue;
+
+            decomposeBoard(Bitboard::fromFEN(FEN_string),
+                FEN::evalStringToFloat(eval_string), limits, chunk);
+        }
+    }
+
+    static void decomposeCachedRows(const DatasetCache::View& dataset, const size_t begin,
+        const size_t end, const FeatureLimits limits, DecomposedChunk& chunk) {
+        for (size_t row = begin; row < end; row++) {
+            const DatasetCache::Record& record = dataset.record(row);
+            decomposeBoard(DatasetCache::unpackBitboard(record), record.evaluation, limits, chunk);
+        }
+    }
+
+    // Adds a finished chunk to the model and frees it. Chunks are merged in
+    // file order, so parent indices come out exactly as from a serial pass
+    static void mergeChunk(EvaluationModel& model, DecomposedChunk& chunk,
+        size_t& lines_processed) {
+        using namespace Chess;
+        for (size_t i = 0; i < chunk.known_evaluation_scores.size(); i++) {
+            model.addParentFeatureKeys(chunk.known_evaluation_scores[i],
+                chunk.feature_keys.data() + chunk.key_offsets[i],
+                chunk.key_offsets[i + 1] - chunk.key_offsets[i]);
+
+            lines_processed++;
+            if (lines_processed % (ORIGINAL_BOARD_SAMPLE_SIZE / 100) == 0)
+                std::cout << lines_processed << '\n';
+        }
+        chunk = DecomposedChunk();
+    }
+
+    // Workers parse and decompose byte ranges of the file while this thread
+    // merges the finished chunks into the model
+    static size_t ingestParallel(EvaluationModel& model, CSVReader& csv_reader,
+        const size_t thread_count) {
+        using namespace Chess;
+        std::string_view sample = csv_reader.text();
+        sample = sample.substr(0, CSVReader::lengthOfRows(sample, ORIGINAL_BOARD_SAMPLE_SIZE));
+        const std::vector<std::string_view> ranges
+            = CSVReader::splitIntoChunks(sample, thread_count * CHUNKS_PER_THREAD);
+        std::vector<DecomposedChunk> chunks(ranges.size());
+        const FeatureLimits limits = featureLimits(model);
+        size_t lines_processed = 0;
+
+        Utility::processChunksInOrder(ranges.size(), thread_count,
+            [&](const size_t i) { decomposeChunk(ranges[i], limits, chunks[i]); },
+            [&](const size_t i) { mergeChunk(model, chunks[i], lines_processed); });
+        return sample.size();
+    }
+
+    // Reads the binary dataset, converting the CSV first if there is no cache
+    // yet or the CSV has changed size since it was built. Returns false if
+    // neither file is usable
+    static bool ingestCachedDataset(EvaluationModel& model, const size_t thread_count) {
+        using namespace Chess::IO;
+        using namespace Chess;
+        std::error_code error;
+        const uintmax_t csv_size
+            = std::filesystem::file_size(CSV_POSITION_EVALUATION_FILE_NAME, error);
+        const bool has_csv = !error;
+
+        bool needs_conversion;
+        {
+            const DatasetCache::View dataset(CACHED_DATASET_FILE_NAME);
+            needs_conversion = !dataset.isValid()
+                || (has_csv && dataset.sourceSize() != csv_size);
+        }
+        if (needs_conversion && (!has_csv || !DatasetCache::convert(
+            CSV_POSITION_EVALUATION_FILE_NAME, CACHED_DATASET_FILE_NAME, thread_count)))
+            return false;
+
+        const auto ingestion_start = std::chrono::steady_clock::now();
+        const DatasetCache::View dataset(CACHED_DATASET_FILE_NAME);
+        if (!dataset.isValid())
+            return false;
+
+        // A streaming model takes every row, in blocks whose decomposed
+        // features stay within half its memory budget
+        const FeatureLimits limits = featureLimits(model);
+        const size_t chunk_count = std::max<size_t>(thread_count, 1) * CHUNKS_PER_THREAD;
+        const size_t row_count = model.isStreaming()
+            ? dataset.rowCount() : std::min(dataset.rowCount(), ORIGINAL_BOARD_SAMPLE_SIZE);
+        const size_t bytes_per_row = featuresPerBoard(limits) * sizeof(FeatureKey)
+            + sizeof(float) + sizeof(size_t);
+        const size_t block_rows = model.isStreaming()
+            ? std::max(model.streamingMemoryBudget() / 2 / bytes_per_row, chunk_count) : row_count;
+        std::vector<DecomposedChunk> chunks(chunk_count);
+        size_t lines_processed = 0;
+
+        for (size_t block_begin = 0; block_begin < row_count; block_begin += block_rows) {
+            const size_t block_size = std::min(block_rows, row_count - block_begin);
+            Utility::processChunksInOrder(chunk_count, thread_count,
+                [&](const size_t i) {
+                    decomposeCachedRows(dataset, block_begin + block_size * i / chunk_count,
+                        block_begin + block_size * (i + 1) / chunk_count, limits, chunks[i]);
+                },
+                [&](const size_t i) { mergeChunk(model, chunks[i], lines_processed); });
+        }
+
+        const double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - ingestion_start).count();
+        std::cout << "Ingested " << model.parentCount() << " cached rows in " << seconds
+            << "s: " << model.parentCount() / seconds << " rows/s" << std::endl;
+        return true;
+    }
+
+    static void ingestSerial(EvaluationModel& model, CSVReader& csv_reader) {
         using namespace Chess::IO;
         using namespace Chess;
-        CSVReader csv_reader(CSV_POSITION_EVALUATION_FILE_NAME);
-        EvaluationModel model;
         size_t lines_processed = 0;
+        std::string_view FEN_string;
+        std::string_view eval_string;
+        std::vector<FeatureKey> feature_keys;
+        const FeatureLimits limits = featureLimits(model);
 
         for (unsigned int i = 0; i < ORIGINAL_BOARD_SAMPLE_SIZE; i++) {
-            const std::vector<std::string>& delimitedLine
-                = csv_reader.delimit(CSV_DELIMITERS);
-            const std::string FEN_string = delimitedLine[0];
-            const std::string eval_string 
-                = delimitedLine[delimitedLine.size() - 1];
+            if (!csv_reader.nextRow(FEN_string, eval_string, CSV_DELIMITERS))
+                break;
+            if (FEN_string.empty())
+                continue;
 
-            const float known_evaluation_score 
+            const float known_evaluation_score
                 = FEN::evalStringToFloat(eval_string);
-            const std::vector<char>& char_sequence 
-                = FEN::positionStringToCharSequence(FEN_string);
 
-            ShapeFeature board(BoardProperties::CHESS_BOARD_PROPERTIES, char_sequence);
-            board.weight(known_evaluation_score);
-            model.addParentShapeFeature(board);
+            feature_keys.clear();
+            forEachFeatureKey(Bitboard::fromFEN(FEN_string), limits,
+                [&feature_keys](const FeatureKey key) { feature_keys.push_back(key); });
+            model.addParentFeatureKeys(known_evaluation_score,
+                feature_keys.data(), feature_keys.size());
 
             lines_processed++;
             if (lines_processed % (ORIGINAL_BOARD_SAMPLE_SIZE / 100) == 0)
-                std::cout << lines_processed << std::endl;
+                std::cout << lines_processed << '\n';
+        }
+    }
+
+    static void init(const size_t thread_count = std::thread::hardware_concurrency(),
+        const EvaluationModel::TrainerType trainer_type = EvaluationModel::MUTATION,
+        const size_t max_feature_width = 1, const size_t max_feature_height = 1,
+        const size_t streaming_memory_budget = 0, const float validation_fraction = 0.f,
+        const bool quantized = false, const bool symmetric_features = false) {
+        using namespace Chess::IO;
+        EvaluationModel model;
+        model.trainerType(trainer_type);
+        model.maxFeatureSize(max_feature_width, max_feature_height);
+        model.symmetricFeatures(symmetric_features);
+        model.threadCount(thread_count);
+        model.streamingMemoryBudget(streaming_memory_budget);
+        model.validation(validation_fraction);
+        model.quantizedScoring(quantized);
+        model.telemetry().open(TELEMETRY_FILE_NAME);
+
+        const auto ingestion_start = std::chrono::steady_clock::now();
+        if (!ingestCachedDataset(model, thread_count)) {
+            CSVReader csv_reader(CSV_POSITION_EVALUATION_FILE_NAME);
+
+            if (thread_count > 1) {
+                const size_t bytes_ingested = ingestParallel(model, csv_reader, thread_count);
+                const double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - ingestion_start).count();
+                std::cout << "Ingested " << model.parentCount() << " rows ("
+                    << bytes_ingested / (1024.0 * 1024.0) << " MB) on " << thread_count
+                    << " threads in " << seconds << "s: " << model.parentCount() / seconds
+                    << " rows/s" << std::endl;
+            }
+            else {
+                ingestSerial(model, csv_reader);
+                csv_reader.printThroughput(std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - ingestion_start).count());
+            }
         }
+        const double ingestion_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - ingestion_start).count();
+        model.telemetry().write(Telemetry::Record("ingest")
+            .field("rows", static_cast<uint64_t>(model.parentCount()))
+            .field("held_out_rows", static_cast<uint64_t>(model.validationParentCount()))
+            .field("features", static_cast<uint64_t>(model.featureCount()))
+            .field("symmetric_features", static_cast<uint64_t>(model.hasSymmetricFeatures()))
+            .field("seconds", ingestion_seconds)
+            .field("rows_per_second", model.parentCount() / ingestion_seconds));
         model.train();
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include "GatherKernel.hpp"
+
+// Rows of 32-bit column indices packed back to back in one array, with
+// m_offsets[r] .. m_offsets[r + 1] marking where row r lives. An entry may
+// carry NEGATED_BIT on top of its column, for a feature that counts with
+// the negated weight; the gather kernels read entries as they are
+class CompressedSparseRows {
+public:
+    static constexpr size_t DROPPED_COLUMN = std::numeric_limits<size_t>::max();
+    static constexpr uint32_t NEGATED_BIT = GatherKernel::NEGATED_BIT;
+
+    static size_t column(const uint32_t entry) {
+        return entry & GatherKernel::INDEX_MASK;
+    }
+
+    static bool isNegated(const uint32_t entry) {
+        return (entry & NEGATED_BIT) != 0;
+    }
+
+    struct Row {
+        const uint32_t* m_begin;
+        const uint32_t* m_end;
+
+        const uint32_t* begin() const { return m_begin; }
+        const uint32_t* end() const { return m_end; }
+        const uint32_t* data() const { return m_begin; }
+        size_t size() const { return static_cast<size_t>(m_end - m_begin); }
+    };
+
+    CompressedSparseRows() :
+        m_offsets(1, 0)
+    {}
+
+    void clear() {
+        m_offsets.assign(1, 0);
+        m_indices.clear();
+    }
+
+    // Opens a new empty row, which appendToLastRow then fills
+    void startRow() {
+        m_offsets.push_back(m_offsets.back());
+    }
+
+    void appendToLastRow(const size_t column, const bool is_negated = false) {
+        m_indices.push_back(static_cast<uint32_t>(column) | (is_negated ? NEGATED_BIT : 0));
+        m_offsets.back()++;
+    }
+
+    Row row(const size_t row_index) const {
+        const uint32_t* indices = m_indices.data();
+        return { indices + m_offsets[row_index], indices + m_offsets[row_index + 1] };
+    }
+
+    size_t rowCount() const {
+        return m_offsets.size() - 1;
+    }
+
+    size_t entryCount() const {
+        return m_indices.size();
+    }
+
+    size_t memoryBytes() const {
+        return m_offsets.capacity() * sizeof(size_t) + m_indices.capacity() * sizeof(uint32_t);
+    }
+
+    // Swaps the roles of rows and columns with a counting sort, so each new row
+    // lists its columns in ascending order. Entries keep their NEGATED_BIT
+    CompressedSparseRows transposed(const size_t column_count) const {
+        CompressedSparseRows result;
+        result.m_offsets.assign(column_count + 1, 0);
+        result.m_indices.resize(m_indices.size());
+
+        for (const uint32_t entry : m_indices)
+            result.m_offsets[column(entry) + 1]++;
+        for (size_t column = 0; column < column_count; column++)
+            result.m_offsets[column + 1] += result.m_offsets[column];
+
+        std::vector<size_t> cursor(result.m_offsets.begin(), result.m_offsets.end() - 1);
+        for (size_t row_index = 0; row_index < rowCount(); row_index++)
+            for (const uint32_t entry : row(row_index))
+                result.m_indices[cursor[column(entry)]++]
+                    = static_cast<uint32_t>(row_index) | (entry & NEGATED_BIT);
+        return result;
+    }
+
+    // Rewrites every column through remapped_columns in place, dropping entries
+    // that map to DROPPED_COLUMN
+    void remapColumns(const std::vector<size_t>& remapped_columns) {
+        size_t kept = 0;
+        size_t row_begin = 0;
+        for (size_t row_index = 0; row_index < rowCount(); row_index++) {
+            const size_t row_end = m_offsets[row_index + 1];
+            for (size_t i = row_begin; i < row_end; i++)
+                if (remapped_columns[column(m_indices[i])] != DROPPED_COLUMN)
+                    m_indices[kept++] = static_cast<uint32_t>(remapped_columns[column(m_indices[i])])
+                        | (m_indices[i] & NEGATED_BIT);
+            row_begin = row_end;
+            m_offsets[row_index + 1] = kept;
+        }
+        m_indices.resize(kept);
+    }
+
+    // Raw offsets then raw indices, the counts have to be stored by the caller
+    void write(std::ostream& output) const {
+        output.write(reinterpret_cast<const char*>(m_offsets.data()),
+            m_offsets.size() * sizeof(size_t));
+        output.write(reinterpret_cast<const char*>(m_indices.data()),
+            m_indices.size() * sizeof(uint32_t));
+    }
+
+    bool read(std::istream& input, const size_t row_count, const size_t entry_count) {
+        m_offsets.resize(row_count + 1);
+        m_indices.resize(entry_count);
+        input.read(reinterpret_cast<char*>(m_offsets.data()), m_offsets.size() * sizeof(size_t));
+        input.read(reinterpret_cast<char*>(m_indices.data()), m_indices.size() * sizeof(uint32_t));
+        return input && m_offsets.front() == 0 && m_offsets.back() == entry_count;
+    }
+
+private:
+    std::vector<size_t> m_offsets;
+    std::vector<uint32_t> m_indices;
+};
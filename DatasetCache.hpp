@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MappedFile.hpp"
+#include "CSVReader.hpp"
+#include "Bitboard.hpp"
+#include "FEN.hpp"
+#include "Utility.hpp"
+#include "Defs.hpp"
+
+// Compact binary copy of chessData.csv: one header followed by fixed-size
+// records, written once and memory mapped by every later run
+namespace DatasetCache {
+    static constexpr char MAGIC[8] = { 'A', 'T', 'M', 'Z', 'D', 'A', 'T', 'A' };
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint8_t MATE_FLAG = 1;
+    static constexpr size_t BYTES_PER_CHUNK = 8 * 1024 * 1024;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t row_count;
+        // Size of the CSV it was built from, so a replaced CSV is noticed
+        uint64_t source_size;
+    };
+
+    // The board holds 4-bit piece codes, two squares per byte, in the square
+    // order of FEN::positionStringToCharSequence
+    struct Record {
+        uint8_t board[32];
+        int16_t evaluation;
+        uint8_t flags;
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(Header) == 32, "Header layout is part of the file format");
+    static_assert(sizeof(Record) == 36, "Record layout is part of the file format");
+
+    static void packBoard(const std::vector<char>& char_sequence, Record& record) {
+        using namespace Chess::LookupTables;
+        for (size_t square = 0; square < 64; square += 2)
+            record.board[square / 2] = static_cast<uint8_t>(PIECE_CODE(char_sequence[square])
+                | (PIECE_CODE(char_sequence[square + 1]) << 4));
+    }
+
+    static Bitboard unpackBitboard(const Record& record) {
+        Bitboard board;
+        for (size_t square = 0; square < 64; square += 2) {
+            board.setPiece(square, record.board[square / 2] & 0xF);
+            board.setPiece(square + 1, record.board[square / 2] >> 4);
+        }
+        return board;
+    }
+
+    static Record makeRecord(std::string_view FEN_string, std::string_view eval_string) {
+        Record record{};
+        packBoard(FEN::positionStringToCharSequence(FEN_string), record);
+        const float evaluation = std::round(FEN::evalStringToFloat(eval_string));
+        record.evaluation = static_cast<int16_t>(std::clamp(evaluation, -32768.f, 32767.f));
+        record.flags = (!eval_string.empty() && eval_string[0] == '#') ? MATE_FLAG : 0;
+        return record;
+    }
+
+    class View {
+    public:
+        View(const std::string& filename) :
+            m_file(filename),
+            m_header(nullptr),
+            m_records(nullptr)
+        {
+            if (m_file.size() < sizeof(Header))
+                return;
+            const Header* header = reinterpret_cast<const Header*>(m_file.data());
+            if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0
+                || header->version != VERSION
+                || header->record_size != sizeof(Record)
+                || m_file.size() < sizeof(Header) + header->row_count * sizeof(Record))
+                return;
+            m_header = header;
+            m_records = reinterpret_cast<const Record*>(m_file.data() + sizeof(Header));
+        }
+
+        bool isValid() const {
+            return m_header != nullptr;
+        }
+
+        size_t rowCount() const {
+            return isValid() ? static_cast<size_t>(m_header->row_count) : 0;
+        }
+
+        uint64_t sourceSize() const {
+            return isValid() ? m_header->source_size : 0;
+        }
+
+        const Record& record(const size_t row) const {
+            return m_records[row];
+        }
+
+    private:
+        MappedFile m_file;
+        const Header* m_header;
+        const Record* m_records;
+    };
+
+    // Converts the whole CSV. Chunks are parsed on worker threads and written
+    // in file order, into a temporary file that replaces the cache at the end
+    static bool convert(const std::string& csv_filename, const std::string& cache_filename,
+        const size_t thread_count) {
+        const auto conversion_start = std::chrono::steady_clock::now();
+        CSVReader csv_reader(csv_filename);
+        const std::string_view text = csv_reader.text();
+        if (text.empty())
+            return false;
+
+        const std::string temporary_filename = cache_filename + ".tmp";
+        std::ofstream output(temporary_filename, std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            std::cout << "Unable to open the file: " << temporary_filename << std::endl;
+            return false;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.record_size = sizeof(Record);
+        header.source_size = text.size();
+        output.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+        const size_t chunk_count = std::max(std::max<size_t>(thread_count, 1) * 8,
+            text.size() / BYTES_PER_CHUNK);
+        const std::vector<std::string_view> ranges = CSVReader::splitIntoChunks(text, chunk_count);
+        std::vector<std::vector<Record>> chunk_records(ranges.size());
+
+        Utility::processChunksInOrder(ranges.size(), thread_count,
+            [&](const size_t chunk) {
+                CSVReader chunk_reader(ranges[chunk]);
+                std::string_view FEN_string;
+                std::string_view eval_string;
+                while (chunk_reader.nextRow(FEN_string, eval_string, Chess::IO::CSV_DELIMITERS))
+                    if (!FEN_string.empty())
+                        chunk_records[chunk].push_back(makeRecord(FEN_string, eval_string));
+            },
+            [&](const size_t chunk) {
+                output.write(reinterpret_cast<const char*>(chunk_records[chunk].data()),
+                    chunk_records[chunk].size() * sizeof(Record));
+                header.row_count += chunk_records[chunk].size();
+                std::vector<Record>().swap(chunk_records[chunk]);
+            });
+
+        output.seekp(0);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        output.close();
+        if (!output)
+            return false;
+
+        std::error_code error;
+        std::filesystem::rename(temporary_filename, cache_filename, error);
+        if (error)
+            return false;
+
+        std::cout << "Converted " << header.row_count << " rows to " << cache_filename << " in "
+            << std::chrono::duration<double>(std::chrono::steady_clock::now() - conversion_start).count()
+            << "s" << std::endl;
+        return true;
+    }
+};
@@ -2,6 +2,7 @@
 #include <array>
 #include <cstdint>
 #include <limits>
+#include <string_view>
 #include "GeometricProperties.hpp"
 
 namespace Chess {
@@ -30,6 +31,28 @@ namespace Chess {
             }
         }
 
+        // 4-bit piece codes used by packed feature keys, 0 is an empty square
+        static constexpr uint8_t PIECE_CODE(char c) {
+            switch (c) {
+            case 'P': return 1;
+            case 'p': return 2;
+            case 'K': return 3;
+            case 'k': return 4;
+            case 'N': return 5;
+            case 'n': return 6;
+            case 'Q': return 7;
+            case 'q': return 8;
+            case 'R': return 9;
+            case 'r': return 10;
+            case 'B': return 11;
+            case 'b': return 12;
+            default: return 0;
+            }
+        }
+
+        static constexpr char CODE_TO_PIECE[16]
+            = { ' ', 'P', 'p', 'K', 'k', 'N', 'n', 'Q', 'q', 'R', 'r', 'B', 'b', ' ', ' ', ' ' };
+
         static constexpr char FILE_NUMBER_TO_LETTER[Chess::FILE_COUNT]
             = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H' };
     };
@@ -37,7 +60,17 @@ namespace Chess {
     namespace IO {
         static constexpr const char* const CSV_POSITION_EVALUATION_FILE_NAME 
             = "chessData.csv";
-        static constexpr const char CSV_DELIMITERS[]{ ' ', ',' };
+        static constexpr const char* const CACHED_DATASET_FILE_NAME
+            = "chessData.bin";
+        static constexpr const char* const MODEL_FILE_NAME
+            = "Model.bin";
+        static constexpr const char* const CHECKPOINT_FILE_NAME
+            = "Checkpoint.bin";
+        static constexpr const char* const TELEMETRY_FILE_NAME
+            = "Telemetry.jsonl";
+        static constexpr const char* const SHARD_DIRECTORY_NAME
+            = "Shards";
+        static constexpr std::string_view CSV_DELIMITERS = " ,";
     };
 
     namespace BoardProperties {
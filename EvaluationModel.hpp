@@ -1,10 +1,31 @@
 #pragma once
+#include <chrono>
+#include <filesystem>
+#include <memory>
 #include "Xoshiro.hpp"
-#include "RadixTree.hpp"
+#include "FeatureTable.hpp"
+#include "FrozenModel.hpp"
+#include "ShapeFeature.hpp"
+#include "QuantizedWeights.hpp"
+#include "CompressedSparseRows.hpp"
+#include "GatherKernel.hpp"
+#include "ThreadPool.hpp"
+#include "Checkpoint.hpp"
+#include "ShardStore.hpp"
+#include "Validator.hpp"
+#include "Telemetry.hpp"
 #include "IO.hpp"
 #include "Defs.hpp"
 
 class EvaluationModel {
+public:
+    enum TrainerType {
+        MUTATION,
+        SGD,
+        ADAM,
+        POPULATION
+    };
+
 private:
     static constexpr size_t ERROR_MAX = std::numeric_limits<size_t>::max();
     static constexpr float ERROR_MAX_FLOAT = std::numeric_limits<float>::max();
@@ -14,25 +35,141 @@ private:
     static constexpr float FREQUENCY_DEFAULT = 0.0107f;
     static constexpr float MAGNITUDE_DEFAULT = 0.5f;
     static constexpr size_t ROUNDS_DEFAULT = 10000;
+    static constexpr size_t MIN_FEATURE_COUNT_DEFAULT = 2;
+    static constexpr size_t MAX_FEATURE_WIDTH_DEFAULT = 1;
+    static constexpr size_t MAX_FEATURE_HEIGHT_DEFAULT = 1;
+    static constexpr float SGD_LEARNING_RATE_DEFAULT = 1.f;
+    static constexpr float ADAM_LEARNING_RATE_DEFAULT = 0.1f;
+    static constexpr size_t BATCH_SIZE_DEFAULT = 256;
+    static constexpr size_t EPOCHS_DEFAULT = 20;
+    static constexpr size_t CHECKPOINT_INTERVAL_ROUNDS_DEFAULT = 1000;
+    static constexpr double CHECKPOINT_INTERVAL_SECONDS_DEFAULT = 300.0;
+    static constexpr float ADAM_BETA1 = 0.9f;
+    static constexpr float ADAM_BETA2 = 0.999f;
+    static constexpr float ADAM_EPSILON = 1e-8f;
+    // Parents per reduction range, sized so a range's scores, errors and
+    // feature lists stay in cache. Fixed so sums don't depend on thread count
+    static constexpr size_t PARENTS_PER_RANGE = 4096;
+    // Shards loaded ahead of the one being trained on when streaming
+    static constexpr size_t SHARD_READ_AHEAD = 2;
+    static constexpr size_t MIN_SHARD_BYTES = 1024 * 1024;
+    static constexpr size_t VALIDATION_PATIENCE_DEFAULT = 10;
+    static constexpr double VALIDATION_MIN_IMPROVEMENT = 1e-4;
+    // Held-out parents stay in memory even when training streams, so there
+    // they get this share of the budget and the shards the rest
+    static constexpr size_t MAX_VALIDATION_PARENTS = 200000;
+    static constexpr double STREAMING_VALIDATION_SHARE = 0.25;
+    // Range kept free above the largest weight while training quantized
+    static constexpr float QUANTIZATION_HEADROOM = 2.f;
+
+    // A sparse set of weight changes and the parents whose scores they move
+    struct MutationCandidate {
+        std::vector<size_t> mutated_features;
+        std::vector<float> weight_deltas;
+        std::vector<size_t> touched_parents;
+        std::vector<float> score_deltas;
+        std::vector<uint8_t> is_touched;
+        double error = 0.0;
+    };
+
+    // One member of the population, with its own random stream. Islands that
+    // climb on their own between migrations also keep their own copy of the
+    // weights and cached parent scores
+    struct Island {
+        Island(const Xoshiro& generator) :
+            generator(generator) {
+        }
+
+        Xoshiro generator;
+        MutationCandidate candidate;
+        std::vector<float> weights;
+        std::vector<float> parent_scores;
+        std::vector<float> parent_errors;
+        double error = 0.0;
+        size_t parents_scored = 0;
+    };
 
-    RadixTree m_shape_feature_tree
-        [GeometricProperties::TYPE_COUNT]
-        [Chess::BoardProperties::CHESS_BOARD_WIDTH]
-        [Chess::BoardProperties::CHESS_BOARD_HEIGHT]
-        [Chess::BoardProperties::CHESS_BOARD_WIDTH]
-        [Chess::BoardProperties::CHESS_BOARD_HEIGHT];
+    // Weight updates of the gradient trainers, shared by in-memory and
+    // streamed training
+    struct GradientState {
+        bool use_adam;
+        float learning_rate;
+        std::vector<float> gradients;
+        std::vector<uint8_t> is_touched;
+        std::vector<size_t> touched_features;
+        std::vector<float> first_moments;
+        std::vector<float> second_moments;
+        size_t step = 0;
+    };
 
-    std::vector<std::vector<size_t>> m_containing_parents_map;
-    std::vector<size_t> m_shape_feature_index_in_tree;
+    FeatureTable m_feature_table;
+
+    CompressedSparseRows m_containing_parents_map;
+    CompressedSparseRows m_feature_parents_map;
+    std::vector<float> m_parent_scores;
+    std::vector<float> m_parent_errors;
+    MutationCandidate m_candidate;
+    std::vector<FeatureKey> m_feature_keys;
+    std::vector<size_t> m_feature_counts;
     std::vector<float> m_expected_scores;
     std::vector<float> m_best_weights;
-    std::vector<float> m_current_weights;
+    std::vector<std::pair<size_t, float>> m_undo_log;
 
     float m_mutation_frequency;
     float m_mutation_magnitude;
-    float m_least_error;
+    double m_least_error;
     size_t m_mutation_rounds;
     size_t m_mapping_index;
+    size_t m_min_feature_count;
+    size_t m_max_feature_width;
+    size_t m_max_feature_height;
+    bool m_symmetric_features;
+
+    TrainerType m_trainer_type;
+    float m_learning_rate;
+    size_t m_batch_size;
+    size_t m_epochs;
+
+    size_t m_population_size;
+    size_t m_migration_interval;
+    std::vector<Island> m_islands;
+
+    size_t m_checkpoint_interval_rounds;
+    double m_checkpoint_interval_seconds;
+
+    Telemetry m_telemetry;
+    PerfCounters m_perf_counters;
+    PerfCounters::Reading m_full_pass_counters;
+    // Reset at every report
+    size_t m_accepted_rounds;
+    size_t m_parents_scored;
+
+    // Set when streaming: parents go to shards on disk instead of staying in
+    // m_containing_parents_map, which only buffers the shard being filled
+    std::unique_ptr<ShardStore> m_shard_store;
+    size_t m_streaming_memory_budget;
+    // A shard that failed to write loses its parents, so training won't start
+    bool m_shard_write_failed;
+    // Pruning as applied to the shards when they are read back
+    std::vector<size_t> m_shard_remapped_columns;
+
+    // Held-out parents are kept as keys until the features are final
+    float m_validation_fraction;
+    size_t m_validation_patience;
+    size_t m_rows_seen;
+    std::vector<FeatureKey> m_validation_keys;
+    std::vector<size_t> m_validation_key_offsets;
+    std::vector<float> m_validation_expected_scores;
+    std::unique_ptr<Validator> m_validator;
+
+    // Full passes and gradient residuals score through this copy of
+    // m_best_weights when set. Mutation deltas stay in float
+    bool m_quantized_scoring;
+    QuantizedWeights m_quantized_weights;
+
+    std::unique_ptr<ThreadPool> m_thread_pool;
+    std::vector<double> m_range_errors;
+    double m_full_pass_seconds;
 
 public:
     EvaluationModel() :
@@ -40,119 +177,763 @@ public:
         m_mapping_index(0),
         m_mutation_frequency(FREQUENCY_DEFAULT),
         m_mutation_magnitude(MAGNITUDE_DEFAULT),
-        m_mutation_rounds(ROUNDS_DEFAULT)
+        m_mutation_rounds(ROUNDS_DEFAULT),
+        m_min_feature_count(MIN_FEATURE_COUNT_DEFAULT),
+        m_max_feature_width(MAX_FEATURE_WIDTH_DEFAULT),
+        m_max_feature_height(MAX_FEATURE_HEIGHT_DEFAULT),
+        m_symmetric_features(false),
+        m_trainer_type(MUTATION),
+        m_learning_rate(0.f),
+        m_batch_size(BATCH_SIZE_DEFAULT),
+        m_epochs(EPOCHS_DEFAULT),
+        m_population_size(0),
+        m_migration_interval(1),
+        m_checkpoint_interval_rounds(CHECKPOINT_INTERVAL_ROUNDS_DEFAULT),
+        m_checkpoint_interval_seconds(CHECKPOINT_INTERVAL_SECONDS_DEFAULT),
+        m_accepted_rounds(0),
+        m_parents_scored(0),
+        m_streaming_memory_budget(0),
+        m_shard_write_failed(false),
+        m_validation_fraction(0.f),
+        m_validation_patience(VALIDATION_PATIENCE_DEFAULT),
+        m_rows_seen(0),
+        m_validation_key_offsets(1, 0),
+        m_quantized_scoring(false),
+        m_thread_pool(new ThreadPool(std::max(std::thread::hardware_concurrency(), 1u))),
+        m_full_pass_seconds(0.0)
     {}
 
+    void threadCount(const size_t thread_count) {
+        m_thread_pool.reset(new ThreadPool(std::max<size_t>(thread_count, 1)));
+    }
+
+    size_t parentCount() const {
+        if (isStreaming())
+            return m_shard_store->parentCount() + m_expected_scores.size();
+        return m_expected_scores.size();
+    }
+
+    size_t featureCount() const {
+        return m_feature_keys.size();
+    }
+
+    size_t validationParentCount() const {
+        return m_validation_expected_scores.size();
+    }
+
+    Telemetry& telemetry() {
+        return m_telemetry;
+    }
+
+    // Feature lookup table, keys and both parent/feature maps
+    size_t indexMemoryBytes() const {
+        return m_feature_table.memoryBytes()
+            + m_feature_keys.capacity() * sizeof(FeatureKey)
+            + m_feature_counts.capacity() * sizeof(size_t)
+            + m_containing_parents_map.memoryBytes()
+            + m_feature_parents_map.memoryBytes();
+    }
+
+    // Weights plus the per-parent scores, errors and targets they are trained against
+    size_t weightMemoryBytes() const {
+        return (m_best_weights.capacity() + m_parent_scores.capacity()
+            + m_parent_errors.capacity() + m_expected_scores.capacity()) * sizeof(float);
+    }
+
+    void trainerType(const TrainerType trainer_type) {
+        m_trainer_type = trainer_type;
+    }
+
+    // Candidates evaluated per generation in POPULATION mode, 0 for one per thread
+    void populationSize(const size_t population_size) {
+        m_population_size = population_size;
+    }
+
+    // Rounds each island climbs on its own before the best one is copied to
+    // all others. 1 evaluates every candidate against the shared best weights
+    void migrationInterval(const size_t migration_interval) {
+        m_migration_interval = std::max<size_t>(migration_interval, 1);
+    }
+
+    // A learning rate of 0 picks the default for the trainer type
+    void learningRate(const float learning_rate) {
+        m_learning_rate = learning_rate;
+    }
+
+    void batchSize(const size_t batch_size) {
+        m_batch_size = std::max<size_t>(batch_size, 1);
+    }
+
+    void epochs(const size_t epochs) {
+        m_epochs = epochs;
+    }
+
+    // Features seen in fewer parents than this are dropped by pruneRareFeatures
+    void minFeatureCount(const size_t min_feature_count) {
+        m_min_feature_count = min_feature_count;
+    }
+
+    // A checkpoint is written every this many rounds or seconds, whichever
+    // comes first. 0 turns that trigger off. Only the round checkpoints
+    // resume exactly where the run was, one taken on time restarts the
+    // islands from the best weights
+    void checkpointInterval(const size_t rounds, const double seconds) {
+        m_checkpoint_interval_rounds = rounds;
+        m_checkpoint_interval_seconds = seconds;
+    }
+
+    // Holds out about this fraction of the rows, chosen by row position, and
+    // scores them on a background thread at every report. Training stops once
+    // patience reports in a row haven't improved the validation error, 0 for
+    // never, and ends on the weights that validated best.
+    // Has to be set before any parent is added, 0 holds nothing out
+    void validation(const float fraction, const size_t patience = VALIDATION_PATIENCE_DEFAULT) {
+        m_validation_fraction = std::clamp(fraction, 0.f, 1.f);
+        m_validation_patience = patience;
+    }
+
+    // Scores parents with int16 weights and one per-model scale, see
+    // QuantizedWeights. The float weights remain the ones that are trained
+    void quantizedScoring(const bool quantized_scoring) {
+        m_quantized_scoring = quantized_scoring;
+    }
+
+    bool isQuantized() const {
+        return m_quantized_scoring;
+    }
+
+    // Trains over parents kept in shards on disk, so the number of parents is
+    // no longer limited by memory. Shards are sized so the ones in memory at
+    // any time, together with the held-out parents, fit in
+    // memory_budget_bytes; per-feature state comes on top.
+    // Has to be set before any parent is added, 0 keeps every parent in memory
+    void streamingMemoryBudget(const size_t memory_budget_bytes) {
+        m_streaming_memory_budget = memory_budget_bytes;
+        if (memory_budget_bytes > 0)
+            m_shard_store.reset(new ShardStore(
+                ShardStore::uniqueDirectory(Chess::IO::SHARD_DIRECTORY_NAME)));
+        else
+            m_shard_store.reset();
+    }
+
+    size_t streamingMemoryBudget() const {
+        return m_streaming_memory_budget;
+    }
+
+    bool isStreaming() const {
+        return m_shard_store != nullptr;
+    }
+
+    // Largest subrectangle, in ranks by files, that parents are decomposed into.
+    // Has to be set before any parent is added
+    void maxFeatureSize(const size_t max_width, const size_t max_height) {
+        using namespace Chess::BoardProperties;
+        m_max_feature_width = std::clamp<size_t>(max_width, 1, CHESS_BOARD_WIDTH);
+        m_max_feature_height = std::clamp<size_t>(max_height, 1, CHESS_BOARD_HEIGHT);
+    }
+
+    size_t maxFeatureWidth() const {
+        return m_max_feature_width;
+    }
+
+    size_t maxFeatureHeight() const {
+        return m_max_feature_height;
+    }
+
+    // Parents are decomposed with Bitboard::forEachSymmetricFeatureKey, so
+    // mirror images share a weight and colour swapped ones its negation.
+    // Has to be set before any parent is added
+    void symmetricFeatures(const bool symmetric_features) {
+        m_symmetric_features = symmetric_features;
+    }
+
+    bool hasSymmetricFeatures() const {
+        return m_symmetric_features;
+    }
+
+    // Read-only copy of the best weights for scoring positions outside training
+    FrozenModel freeze() const {
+        return FrozenModel(m_feature_keys, m_best_weights,
+            m_max_feature_width, m_max_feature_height, m_symmetric_features);
+    }
+
     void loadBestWeights(const std::string& file_name) {
         const std::pair<std::vector<float>, bool>& weights_success
             = IO::readFloatVectorFromFile(file_name);
-        if (weights_success.second)
+        if (weights_success.second) {
             if (weights_success.first.size() == m_best_weights.size())
                 m_best_weights = weights_success.first;
+            else
+                std::cout << "Ignoring " << file_name << ": it holds "
+                    << weights_success.first.size() << " weights, the model has "
+                    << m_best_weights.size() << std::endl;
+        }
+    }
+
+    // Takes the weight of every feature the saved model also has, matched by
+    // key, so it works whatever rows or order the features came from.
+    // Returns false if there is no usable model file. Keys only mean the same
+    // feature under the same symmetry and size limits, so a model saved with
+    // others isn't usable
+    bool loadModelWeights(const std::string& file_name) {
+        const FrozenModel saved_model(file_name);
+        if (!saved_model.isValid())
+            return false;
+        if (saved_model.hasSymmetricFeatures() != m_symmetric_features
+            || saved_model.maxFeatureWidth() != m_max_feature_width
+            || saved_model.maxFeatureHeight() != m_max_feature_height) {
+            std::cout << "Ignoring " << file_name
+                << ": it was saved with different feature settings" << std::endl;
+            return false;
+        }
+        size_t matched_count = 0;
+        for (size_t i = 0; i < m_feature_keys.size(); i++) {
+            const size_t saved_index = saved_model.find(m_feature_keys[i]);
+            if (saved_index == saved_model.featureCount())
+                continue;
+            m_best_weights[i] = saved_model.weightAt(saved_index);
+            matched_count++;
+        }
+        std::cout << "Loaded " << matched_count << " of " << m_feature_keys.size()
+            << " feature weights from " << file_name << std::endl;
+        return true;
+    }
+
+    void saveModel(const std::string& file_name) const {
+        freeze().save(file_name);
+    }
+
+    // Copy of the state after the given round, for a CheckpointWriter
+    Checkpoint snapshot(const size_t round) const {
+        Checkpoint checkpoint;
+        checkpoint.round = round;
+        checkpoint.key_fingerprint = Checkpoints::fingerprint(m_feature_keys);
+        checkpoint.least_error = m_least_error;
+        checkpoint.mutation_frequency = m_mutation_frequency;
+        checkpoint.mutation_magnitude = m_mutation_magnitude;
+        checkpoint.rng_state = rng.state();
+        for (const Island& island : m_islands)
+            checkpoint.island_rng_states.push_back(island.generator.state());
+        checkpoint.weights = m_best_weights;
+        return checkpoint;
+    }
+
+    // Restores a checkpoint taken from the same features. Returns the round
+    // to carry on from, 0 when there is nothing to resume
+    size_t resumeFromCheckpoint(const std::string& file_name) {
+        Checkpoint checkpoint;
+        if (!Checkpoints::read(file_name, checkpoint, m_best_weights.size()))
+            return 0;
+        if (checkpoint.key_fingerprint != Checkpoints::fingerprint(m_feature_keys)) {
+            std::cout << "Ignoring " << file_name
+                << ": it was written for a different set of features" << std::endl;
+            return 0;
+        }
+
+        m_best_weights = checkpoint.weights;
+        m_least_error = checkpoint.least_error;
+        m_mutation_frequency = checkpoint.mutation_frequency;
+        m_mutation_magnitude = checkpoint.mutation_magnitude;
+        rng.state(checkpoint.rng_state);
+        if (!checkpoint.island_rng_states.empty()) {
+            m_population_size = checkpoint.island_rng_states.size();
+            seedIslands();
+            for (size_t i = 0; i < m_islands.size(); i++)
+                m_islands[i].generator.state(checkpoint.island_rng_states[i]);
+        }
+        std::cout << "Resuming from " << file_name << " after round " << checkpoint.round
+            << ", least error " << checkpoint.least_error << std::endl;
+        return static_cast<size_t>(checkpoint.round) + 1;
     }
 
     void addParentShapeFeature(const ShapeFeature& parent_shape_feature) {
-        m_containing_parents_map.push_back(std::vector<size_t>(0));
-        const std::vector<ShapeFeature>& sub_shape_features
-            = parent_shape_feature.decomposeIntoSubquadrillaterals();
-        m_expected_scores.push_back(parent_shape_feature.weight());
+        addDecomposedParentShapeFeature(parent_shape_feature.weight(),
+            parent_shape_feature.decomposeIntoSubquadrillaterals(
+                m_max_feature_width, m_max_feature_height));
+    }
+
+    // Takes a parent that was already decomposed, e.g. by an ingestion worker thread
+    void addDecomposedParentShapeFeature(const float known_evaluation_score,
+        const std::vector<ShapeFeature>& sub_shape_features) {
+        if (holdOutNextParent()) {
+            for (const ShapeFeature& sub_shape_feature : sub_shape_features)
+                m_validation_keys.push_back(sub_shape_feature.packedKey());
+            addValidationParent(known_evaluation_score);
+            return;
+        }
+        m_containing_parents_map.startRow();
+        m_expected_scores.push_back(known_evaluation_score);
         for (unsigned int i = 0; i < sub_shape_features.size(); i++)
-            insertShapeFeature(m_expected_scores.size() - 1, sub_shape_features[i]);
+            mapShapeFeatureToTreeIndex(sub_shape_features[i]);
+        if (isStreaming() && bufferedShardBytes() >= shardBytes())
+            flushShard();
+    }
+
+    // Takes a parent as the keys of its features, e.g. straight from a Bitboard
+    void addParentFeatureKeys(const float known_evaluation_score,
+        const FeatureKey* feature_keys, const size_t key_count) {
+        if (holdOutNextParent()) {
+            m_validation_keys.insert(m_validation_keys.end(), feature_keys, feature_keys + key_count);
+            addValidationParent(known_evaluation_score);
+            return;
+        }
+        m_containing_parents_map.startRow();
+        m_expected_scores.push_back(known_evaluation_score);
+        for (size_t i = 0; i < key_count; i++)
+            mapFeatureKeyToIndex(feature_keys[i]);
+        if (isStreaming() && bufferedShardBytes() >= shardBytes())
+            flushShard();
+    }
+
+    // Decided by a hash of the row's position rather than the generator, so
+    // the same rows are held out every run and training draws the same numbers
+    bool holdOutNextParent() {
+        const size_t row = m_rows_seen++;
+        if (m_validation_fraction <= 0.f || validationParentCount() >= MAX_VALIDATION_PARENTS
+            || (isStreaming() && validationBytes() >= validationBudgetBytes()))
+            return false;
+        const double position = static_cast<double>(FeatureKeys::mix(row) >> 11) / 9007199254740992.0;
+        return position < m_validation_fraction;
+    }
+
+    // Closes a held-out parent whose keys were just appended
+    void addValidationParent(const float known_evaluation_score) {
+        m_validation_expected_scores.push_back(known_evaluation_score);
+        m_validation_key_offsets.push_back(m_validation_keys.size());
+    }
+
+    // Target size of one shard: the one being trained on, SHARD_READ_AHEAD
+    // loaded ones and the one being read all fit in what the held-out
+    // parents leave of the budget
+    size_t shardBytes() const {
+        return std::max((m_streaming_memory_budget - validationBudgetBytes()) / (SHARD_READ_AHEAD + 2),
+            MIN_SHARD_BYTES);
+    }
+
+    size_t validationBudgetBytes() const {
+        if (m_validation_fraction <= 0.f)
+            return 0;
+        return static_cast<size_t>(m_streaming_memory_budget * STREAMING_VALIDATION_SHARE);
+    }
+
+    // Held-out keys, offsets and scores. The validator's rows that replace
+    // the keys take half as much, a feature index being 4 bytes
+    size_t validationBytes() const {
+        return m_validation_keys.size() * sizeof(FeatureKey)
+            + m_validation_key_offsets.size() * sizeof(size_t)
+            + m_validation_expected_scores.size() * sizeof(float);
+    }
+
+    size_t bufferedShardBytes() const {
+        return m_expected_scores.size() * (sizeof(float) + sizeof(size_t))
+            + m_containing_parents_map.entryCount() * sizeof(uint32_t);
+    }
+
+    // Writes the buffered parents out as the next shard
+    void flushShard() {
+        if (m_expected_scores.empty())
+            return;
+        Shard shard;
+        shard.expected_scores.swap(m_expected_scores);
+        shard.rows = std::move(m_containing_parents_map);
+        m_containing_parents_map.clear();
+        if (!m_shard_store->write(shard))
+            m_shard_write_failed = true;
     }
 
-    RadixTree& resolveShapeFeatureTreeWithHeader(const std::string& header) {
-        const size_t type_index = Utility::charToDigit(header[0]);
-        const size_t width_index = Utility::charToDigit(header[1]) - 1;
-        const size_t height_index = Utility::charToDigit(header[2]) - 1;
-        const size_t offset_x_index = Utility::charToDigit(header[3]);
-        const size_t offset_y_index = Utility::charToDigit(header[4]);
-        return m_shape_feature_tree[type_index][width_index][height_index][offset_x_index][offset_y_index];
+    // Features are always added to the parent added most recently
+    void insertShapeFeature(const ShapeFeature& shape_feature) {
+        insertFeatureKey(shape_feature.packedKey());
     }
 
-    void insertShapeFeature(const size_t parent_shape_index, const ShapeFeature& shape_feature) {
-        const std::string& serialized = shape_feature.serialized();
-        RadixTree& shape_feature_tree = resolveShapeFeatureTreeWithHeader(serialized.substr(0, LENGTH));
-        shape_feature_tree.insert(serialized.substr(LENGTH), m_mapping_index);
-        m_shape_feature_index_in_tree.push_back(m_mapping_index);
-        m_containing_parents_map[parent_shape_index].push_back(m_mapping_index);
+    void insertFeatureKey(const FeatureKey key, const bool is_negated = false) {
+        m_feature_table.insert(key, m_mapping_index);
+        m_feature_keys.push_back(key);
+        m_feature_counts.push_back(1);
+        m_containing_parents_map.appendToLastRow(m_mapping_index, is_negated);
         m_best_weights.push_back(0.f);
-        m_current_weights.push_back(0.f);
         m_mapping_index++;
     }
 
-    void mapShapeFeatureToTreeIndex(const size_t parent_shape_index, 
-        const ShapeFeature& shape_feature) {
-        const std::string& serialized = shape_feature.serialized();
-        const auto& [exists, existing_index] 
-            = m_shape_feature_tree
-            [Utility::charToDigit(serialized[0])]
-            [Utility::charToDigit(serialized[1]) - 1]
-            [Utility::charToDigit(serialized[2]) - 1]
-            [Utility::charToDigit(serialized[3])]
-            [Utility::charToDigit(serialized[4])]
-            .search(serialized.substr(LENGTH));
-
-        if (!exists)
-            insertShapeFeature(parent_shape_index, serialized);
-        else
-            m_containing_parents_map[parent_shape_index].push_back(existing_index);
+    void mapShapeFeatureToTreeIndex(const ShapeFeature& shape_feature) {
+        mapFeatureKeyToIndex(shape_feature.packedKey());
+    }
+
+    // Interns the feature: a key seen before shares its existing weight slot.
+    // A negated key is stored without its flag and marks the parent's entry
+    void mapFeatureKeyToIndex(const FeatureKey key) {
+        const bool is_negated = FeatureKeys::isNegated(key);
+        const auto& [exists, existing_index] = m_feature_table.search(FeatureKeys::withoutSign(key));
+
+        if (!exists) {
+            insertFeatureKey(FeatureKeys::withoutSign(key), is_negated);
+        }
+        else {
+            m_containing_parents_map.appendToLastRow(existing_index, is_negated);
+            m_feature_counts[existing_index]++;
+        }
+    }
+
+    // Drops features seen fewer than m_min_feature_count times and compacts
+    // every per-feature vector, keeping the survivors in their original order
+    void pruneRareFeatures() {
+        const size_t unique_count = m_feature_keys.size();
+        std::vector<size_t> remapped_index(unique_count, CompressedSparseRows::DROPPED_COLUMN);
+        size_t kept_count = 0;
+
+        m_feature_table.clear();
+        for (size_t i = 0; i < unique_count; i++) {
+            if (m_feature_counts[i] < m_min_feature_count)
+                continue;
+            remapped_index[i] = kept_count;
+            m_feature_keys[kept_count] = m_feature_keys[i];
+            m_feature_counts[kept_count] = m_feature_counts[i];
+            m_best_weights[kept_count] = m_best_weights[i];
+            m_feature_table.insert(m_feature_keys[kept_count], kept_count);
+            kept_count++;
+        }
+        m_feature_keys.resize(kept_count);
+        m_feature_counts.resize(kept_count);
+        m_best_weights.resize(kept_count);
+        m_mapping_index = kept_count;
+
+        m_containing_parents_map.remapColumns(remapped_index);
+        if (isStreaming())
+            m_shard_remapped_columns = std::move(remapped_index);
+
+        std::cout << "Features: " << unique_count << " unique, " << kept_count
+            << " seen at least " << m_min_feature_count << " times" << std::endl;
     }
 
     static float calculateError(float actual_result, float expected_result) {
         return std::fabs(actual_result - expected_result);
     }
 
-    float calculateScore(const size_t parent_index) {
-        float total_score = 0.0;
-            for (unsigned int i = 0; i < m_containing_parents_map[parent_index].size(); i++)
-                total_score += m_current_weights[m_containing_parents_map[parent_index][i]];
-        return total_score;
+    float calculateScore(const size_t parent_index, const std::vector<float>& weights) const {
+        const CompressedSparseRows::Row features = m_containing_parents_map.row(parent_index);
+        return GatherKernel::sum(weights.data(), features.data(), features.size());
     }
 
-    float calculateAllErrors() {
-        float all_errors = 0.0;
-        for (unsigned int i = 0; i < m_containing_parents_map.size(); i++)
-            all_errors += calculateError(calculateScore(i), 
-                calculateExpectedScore(i));
+    // Sum of the best weights of the features, quantized in quantized mode
+    float scoreFeatures(const CompressedSparseRows::Row features) const {
+        if (m_quantized_scoring)
+            return m_quantized_weights.sum(features.data(), features.size());
+        return GatherKernel::sum(m_best_weights.data(), features.data(), features.size());
+    }
+
+    void syncQuantizedWeights() {
+        if (m_quantized_scoring)
+            m_quantized_weights.quantize(m_best_weights, QUANTIZATION_HEADROOM);
+    }
+
+    size_t rangeCount() const {
+        return (parentCount() + PARENTS_PER_RANGE - 1) / PARENTS_PER_RANGE;
+    }
+
+    // Adds up per-range partial sums in range order, so the total comes out
+    // bitwise identical however many threads produced them
+    double sumRangeErrors() const {
+        double all_errors = 0.0;
+        for (const double range_error : m_range_errors)
+            all_errors += range_error;
         return all_errors;
     }
 
-    float calculateExpectedScore(const size_t parent_index) {
-        const float known_evaluation_score 
-            = m_expected_scores[parent_index];
+    float calculateAllErrors() {
+        syncQuantizedWeights();
+        m_perf_counters.start();
+        m_range_errors.assign(rangeCount(), 0.0);
+        m_thread_pool->parallelFor(rangeCount(), [this](const size_t range) {
+            const size_t range_end = std::min((range + 1) * PARENTS_PER_RANGE, parentCount());
+            double range_error = 0.0;
+            for (size_t i = range * PARENTS_PER_RANGE; i < range_end; i++)
+                range_error += calculateError(scoreFeatures(m_containing_parents_map.row(i)),
+                    calculateExpectedScore(i));
+            m_range_errors[range] = range_error;
+        });
+        m_full_pass_counters = m_perf_counters.stop();
+        m_parents_scored += parentCount();
+        return static_cast<float>(sumRangeErrors());
+    }
+
+    float calculateExpectedScore(const size_t parent_index) const {
+        return clampExpectedScore(m_expected_scores[parent_index]);
+    }
+
+    static float clampExpectedScore(const float known_evaluation_score) {
         if (known_evaluation_score > 0.f)
             return std::min(known_evaluation_score, EVALUATION_MAX);
         return std::max(known_evaluation_score, EVALUATION_MIN);
     }
 
+    // Inverse of m_containing_parents_map, used to find the parents a mutation touches
+    void buildFeatureParentsMap() {
+        m_feature_parents_map = m_containing_parents_map.transposed(m_best_weights.size());
+    }
+
+    // Scores every parent against m_best_weights from scratch. Also run now and
+    // then during training to wash out rounding drift in the incremental updates
+    void resetCachedScores() {
+        const auto pass_start = std::chrono::steady_clock::now();
+        syncQuantizedWeights();
+        m_perf_counters.start();
+        m_parent_scores.resize(parentCount());
+        m_parent_errors.resize(parentCount());
+        m_range_errors.assign(rangeCount(), 0.0);
+        m_thread_pool->parallelFor(rangeCount(), [this](const size_t range) {
+            const size_t range_end = std::min((range + 1) * PARENTS_PER_RANGE, parentCount());
+            double range_error = 0.0;
+            for (size_t i = range * PARENTS_PER_RANGE; i < range_end; i++) {
+                m_parent_scores[i] = scoreFeatures(m_containing_parents_map.row(i));
+                m_parent_errors[i] = calculateError(m_parent_scores[i], calculateExpectedScore(i));
+                range_error += m_parent_errors[i];
+            }
+            m_range_errors[range] = range_error;
+        });
+        m_least_error = sumRangeErrors();
+        m_full_pass_counters = m_perf_counters.stop();
+        m_parents_scored += parentCount();
+        m_full_pass_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - pass_start).count();
+    }
+
+    double calculateCandidateError(MutationCandidate& candidate) const {
+        return calculateCandidateError(candidate, m_best_weights, m_parent_scores, m_parent_errors, m_least_error);
+    }
+
+    // Total error with the candidate applied to weights, the weights that
+    // produced parent_scores, re-scoring only the parents that contain a
+    // mutated feature
+    double calculateCandidateError(MutationCandidate& candidate, const std::vector<float>& weights,
+        const std::vector<float>& parent_scores, const std::vector<float>& parent_errors,
+        const double total_error) const {
+        candidate.score_deltas.resize(parentCount(), 0.f);
+        candidate.is_touched.resize(parentCount(), 0);
+
+        for (size_t i = 0; i < candidate.mutated_features.size(); i++) {
+            const float weight_delta = scoredWeightDelta(
+                weights[candidate.mutated_features[i]], candidate.weight_deltas[i]);
+            for (const uint32_t entry : m_feature_parents_map.row(candidate.mutated_features[i])) {
+                const size_t parent_index = CompressedSparseRows::column(entry);
+                if (!candidate.is_touched[parent_index]) {
+                    candidate.is_touched[parent_index] = 1;
+                    candidate.touched_parents.push_back(parent_index);
+                }
+                candidate.score_deltas[parent_index]
+                    += CompressedSparseRows::isNegated(entry) ? -weight_delta : weight_delta;
+            }
+        }
+
+        double error = total_error;
+        for (const size_t parent_index : candidate.touched_parents)
+            error += calculateError(
+                parent_scores[parent_index] + candidate.score_deltas[parent_index],
+                calculateExpectedScore(parent_index)) - parent_errors[parent_index];
+        candidate.error = error;
+        return error;
+    }
+
+    void acceptCandidate(const MutationCandidate& candidate) {
+        acceptCandidate(candidate, m_parent_scores, m_parent_errors, m_least_error);
+    }
+
+    void acceptCandidate(const MutationCandidate& candidate, std::vector<float>& parent_scores,
+        std::vector<float>& parent_errors, double& total_error) const {
+        for (const size_t parent_index : candidate.touched_parents) {
+            parent_scores[parent_index] += candidate.score_deltas[parent_index];
+            parent_errors[parent_index] = calculateError(
+                parent_scores[parent_index], calculateExpectedScore(parent_index));
+        }
+        total_error = candidate.error;
+    }
+
+    static void applyCandidateWeights(const MutationCandidate& candidate,
+        std::vector<float>& weights) {
+        for (size_t i = 0; i < candidate.mutated_features.size(); i++)
+            weights[candidate.mutated_features[i]] += candidate.weight_deltas[i];
+    }
+
+    // How far a mutation moves the score of a parent containing the feature.
+    // Quantized, that is the change of the weight's int16 step at the scale
+    // of the last resync, so cached scores stay sums of int16 weights
+    float scoredWeightDelta(const float weight, const float weight_delta) const {
+        if (m_quantized_scoring)
+            return m_quantized_weights.stepDelta(weight, weight_delta);
+        return weight_delta;
+    }
+
+    // Brings the int16 copy of the mutated best weights up to date, keeping
+    // the scale so the cached scores stay valid until the next resync
+    void syncCandidateQuantizedWeights(const MutationCandidate& candidate) {
+        if (!m_quantized_scoring)
+            return;
+        for (const size_t feature_index : candidate.mutated_features)
+            m_quantized_weights.set(feature_index, m_best_weights[feature_index]);
+    }
+
+    // Picks each weight with probability m_mutation_frequency without visiting
+    // the others: the gap to the next picked weight is geometric, so it is
+    // drawn directly as floor(log(u) / log(1 - p)). The cost of a round then
+    // follows the number of mutations rather than the number of weights
+    void sampleCandidate(MutationCandidate& candidate, Xoshiro& generator) const {
+        const size_t feature_count = m_best_weights.size();
+        if (m_mutation_frequency <= 0.f || feature_count == 0)
+            return;
+
+        const double log_miss = m_mutation_frequency < 1.f
+            ? std::log1p(-static_cast<double>(m_mutation_frequency)) : 0.0;
+        size_t feature_index = 0;
+        while (true) {
+            if (log_miss < 0.0) {
+                const double skip = std::floor(std::log(
+                    std::max(static_cast<double>(generator()), 1e-300)) / log_miss);
+                if (skip >= static_cast<double>(feature_count - feature_index))
+                    return;
+                feature_index += static_cast<size_t>(skip);
+            }
+
+            const float mutation = (2 * generator() - 1) * m_mutation_magnitude;
+            candidate.mutated_features.push_back(feature_index);
+            candidate.weight_deltas.push_back(mutation);
+            if (++feature_index >= feature_count)
+                return;
+        }
+    }
+
+    // Gives every population member its own stream, each one jump() (2^128
+    // draws) past the previous, and copies the best state onto each island
+    void seedIslands() {
+        const size_t population_size = m_population_size > 0
+            ? m_population_size : m_thread_pool->threadCount();
+        Xoshiro generator = rng;
+        m_islands.clear();
+        for (size_t i = 0; i < population_size; i++) {
+            generator.jump();
+            m_islands.emplace_back(generator);
+        }
+        migrateBestIsland();
+    }
+
+    void migrateBestIsland() {
+        if (m_migration_interval <= 1)
+            return;
+        for (Island& island : m_islands) {
+            island.weights = m_best_weights;
+            island.parent_scores = m_parent_scores;
+            island.parent_errors = m_parent_errors;
+            island.error = m_least_error;
+        }
+    }
+
+    // One generation: every member proposes a candidate on its own thread and
+    // the lowest error wins, ties going to the lowest member so the outcome
+    // doesn't depend on scheduling. With a migration interval each island
+    // first hill climbs that many rounds on its own copy
+    float performPopulationGeneration() {
+        if (m_islands.empty())
+            seedIslands();
+
+        m_thread_pool->parallelFor(m_islands.size(), [this](const size_t island_index) {
+            Island& island = m_islands[island_index];
+            if (m_migration_interval <= 1) {
+                clearCandidate(island.candidate);
+                sampleCandidate(island.candidate, island.generator);
+                island.error = calculateCandidateError(island.candidate);
+                island.parents_scored += island.candidate.touched_parents.size();
+                return;
+            }
+            for (size_t round = 0; round < m_migration_interval; round++) {
+                sampleCandidate(island.candidate, island.generator);
+                calculateCandidateError(island.candidate, island.weights,
+                    island.parent_scores, island.parent_errors, island.error);
+                island.parents_scored += island.candidate.touched_parents.size();
+                if (island.candidate.error < island.error) {
+                    acceptCandidate(island.candidate,
+                        island.parent_scores, island.parent_errors, island.error);
+                    applyCandidateWeights(island.candidate, island.weights);
+                }
+                clearCandidate(island.candidate);
+            }
+        });
+
+        for (Island& island : m_islands) {
+            m_parents_scored += island.parents_scored;
+            island.parents_scored = 0;
+        }
+
+        size_t best_index = 0;
+        for (size_t i = 1; i < m_islands.size(); i++)
+            if (m_islands[i].error < m_islands[best_index].error)
+                best_index = i;
+        Island& best_island = m_islands[best_index];
+        const double generation_error = best_island.error;
+
+        if (generation_error < m_least_error) {
+            m_accepted_rounds++;
+            if (m_migration_interval <= 1) {
+                acceptCandidate(best_island.candidate);
+                applyCandidateWeights(best_island.candidate, m_best_weights);
+                syncCandidateQuantizedWeights(best_island.candidate);
+            }
+            else {
+                m_best_weights = best_island.weights;
+                m_parent_scores = best_island.parent_scores;
+                m_parent_errors = best_island.parent_errors;
+                m_least_error = best_island.error;
+                if (m_quantized_scoring)
+                    m_quantized_weights.requantize(m_best_weights);
+            }
+        }
+        migrateBestIsland();
+        return static_cast<float>(generation_error);
+    }
+
+    static void clearCandidate(MutationCandidate& candidate) {
+        for (const size_t parent_index : candidate.touched_parents) {
+            candidate.score_deltas[parent_index] = 0.f;
+            candidate.is_touched[parent_index] = 0;
+        }
+        candidate.touched_parents.clear();
+        candidate.mutated_features.clear();
+        candidate.weight_deltas.clear();
+    }
+
+    // Mutations go straight into m_best_weights. A rejected round is rolled
+    // back from the undo log, which restores the exact previous values rather
+    // than subtracting the deltas again and picking up rounding error
     float performWeightMutationsAndSetIfBest() {
-        m_current_weights = m_best_weights;
-        for (unsigned int i = 0; i < m_current_weights.size(); i++) {
-            float mutation = (2 * rng() - 1) * (rng() < m_mutation_frequency) * m_mutation_magnitude;
-            m_current_weights[i] += mutation;
+        sampleCandidate(m_candidate, rng);
+        // Scored first, quantized deltas are taken from the unmutated weights
+        const double current_error = calculateCandidateError(m_candidate);
+        m_parents_scored += m_candidate.touched_parents.size();
+
+        m_undo_log.clear();
+        for (size_t i = 0; i < m_candidate.mutated_features.size(); i++) {
+            const size_t feature_index = m_candidate.mutated_features[i];
+            m_undo_log.emplace_back(feature_index, m_best_weights[feature_index]);
+            m_best_weights[feature_index] += m_candidate.weight_deltas[i];
         }
-        const float current_error = calculateAllErrors();
         if (current_error < m_least_error) {
-            m_least_error = current_error;
-            m_best_weights = m_current_weights;
+            acceptCandidate(m_candidate);
+            syncCandidateQuantizedWeights(m_candidate);
+            m_accepted_rounds++;
+        }
+        else {
+            for (size_t i = m_undo_log.size(); i > 0; i--)
+                m_best_weights[m_undo_log[i - 1].first] = m_undo_log[i - 1].second;
         }
-        return current_error;
+        clearCandidate(m_candidate);
+        return static_cast<float>(current_error);
     }
 
     float scoreHiddenParentShapeFeature(const ShapeFeature& hidden_parent_shape_feature) {
         const std::vector<ShapeFeature>& hidden_shape_features
-            = hidden_parent_shape_feature.decomposeIntoSubquadrillaterals();
+            = hidden_parent_shape_feature.decomposeIntoSubquadrillaterals(
+                m_max_feature_width, m_max_feature_height);
         float score = 0.f;
         for (auto& hidden_shape_feature : hidden_shape_features) {
-            const std::string& serialized = hidden_shape_feature.serialized();
             const auto& [exists, existing_index]
-                = m_shape_feature_tree
-                [Utility::charToDigit(serialized[0])]
-            [Utility::charToDigit(serialized[1]) - 1]
-            [Utility::charToDigit(serialized[2]) - 1]
-            [Utility::charToDigit(serialized[3])]
-            [Utility::charToDigit(serialized[4])]
-            .search(serialized.substr(LENGTH));
+                = m_feature_table.search(hidden_shape_feature.packedKey());
 
             if (exists)
                 score += m_best_weights[existing_index];
@@ -160,24 +941,457 @@ public:
         return score;
     }
 
-    void train() {
-        loadBestWeights("BestWeights.txt");
-        for (unsigned int k = 0; k < m_mutation_rounds; k++) {
-            performWeightMutationsAndSetIfBest();
+    GradientState makeGradientState() const {
+        const bool use_adam = m_trainer_type == ADAM;
+        const size_t feature_count = m_best_weights.size();
+        GradientState state;
+        state.use_adam = use_adam;
+        state.learning_rate = m_learning_rate > 0.f ? m_learning_rate
+            : (use_adam ? ADAM_LEARNING_RATE_DEFAULT : SGD_LEARNING_RATE_DEFAULT);
+        state.gradients.assign(feature_count, 0.f);
+        state.is_touched.assign(feature_count, 0);
+        state.first_moments.assign(use_adam ? feature_count : 0, 0.f);
+        state.second_moments.assign(use_adam ? feature_count : 0, 0.f);
+        return state;
+    }
+
+    static void accumulateGradient(GradientState& state, const CompressedSparseRows::Row features,
+        const float residual, const float batch_scale) {
+        const float gradient = ((residual > 0.f) - (residual < 0.f)) * batch_scale;
+        for (const uint32_t entry : features) {
+            const size_t feature_index = CompressedSparseRows::column(entry);
+            if (!state.is_touched[feature_index]) {
+                state.is_touched[feature_index] = 1;
+                state.touched_features.push_back(feature_index);
+            }
+            state.gradients[feature_index] += CompressedSparseRows::isNegated(entry) ? -gradient : gradient;
+        }
+    }
+
+    // Steps every weight the batch touched and clears its gradient
+    void applyGradientStep(GradientState& state) {
+        state.step++;
+        const float first_correction = 1.f - std::pow(ADAM_BETA1, static_cast<float>(state.step));
+        const float second_correction = 1.f - std::pow(ADAM_BETA2, static_cast<float>(state.step));
+        bool needs_requantizing = false;
+        for (const size_t feature_index : state.touched_features) {
+            const float gradient = state.gradients[feature_index];
+            if (state.use_adam) {
+                float& first_moment = state.first_moments[feature_index];
+                float& second_moment = state.second_moments[feature_index];
+                first_moment = ADAM_BETA1 * first_moment + (1.f - ADAM_BETA1) * gradient;
+                second_moment = ADAM_BETA2 * second_moment + (1.f - ADAM_BETA2) * gradient * gradient;
+                m_best_weights[feature_index] -= state.learning_rate * (first_moment / first_correction)
+                    / (std::sqrt(second_moment / second_correction) + ADAM_EPSILON);
+            }
+            else {
+                m_best_weights[feature_index] -= state.learning_rate * gradient;
+            }
+            state.gradients[feature_index] = 0.f;
+            state.is_touched[feature_index] = 0;
+            if (m_quantized_scoring && !needs_requantizing)
+                needs_requantizing = !m_quantized_weights.update(feature_index, m_best_weights[feature_index]);
+        }
+        state.touched_features.clear();
+        if (needs_requantizing)
+            syncQuantizedWeights();
+    }
+
+    // Mini-batch descent on the mean absolute error. A parent's score is the sum
+    // of its feature weights, so d|score - expected| / d weight is just the sign
+    // of the residual for every feature the parent contains. Only the weights a
+    // batch touched are stepped, Adam's moments included
+    void trainGradient() {
+        GradientState state = makeGradientState();
+        std::vector<size_t> order(parentCount());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+
+        for (size_t epoch = 0; epoch < m_epochs; epoch++) {
+            for (size_t i = order.size(); i > 1; i--)
+                std::swap(order[i - 1], order[static_cast<size_t>(rng() * i) % i]);
+
+            for (size_t batch_begin = 0; batch_begin < order.size(); batch_begin += m_batch_size) {
+                const size_t batch_end = std::min(batch_begin + m_batch_size, order.size());
+                const float batch_scale = 1.f / static_cast<float>(batch_end - batch_begin);
+
+                for (size_t i = batch_begin; i < batch_end; i++) {
+                    const size_t parent_index = order[i];
+                    const float residual = scoreFeatures(m_containing_parents_map.row(parent_index))
+                        - calculateExpectedScore(parent_index);
+                    accumulateGradient(state, m_containing_parents_map.row(parent_index),
+                        residual, batch_scale);
+                }
+                applyGradientStep(state);
+            }
+
+            resetCachedScores();
+            m_telemetry.write(Telemetry::Record("epoch")
+                .field("epoch", static_cast<uint64_t>(epoch + 1))
+                .field("best_error", m_least_error)
+                .field("full_pass_seconds", m_full_pass_seconds));
+            std::cout << "Epoch " << epoch + 1 << "/" << m_epochs
+                << " Least Error: " << m_least_error << '\n';
+            if (validate(epoch + 1))
+                break;
+        }
+    }
+
+    // trainGradient over the shards on disk. Every epoch visits the shards in
+    // a new random order and shuffles the parents within each one, so only
+    // the shards being read ahead are ever in memory. The epoch error is each
+    // parent's error just before its batch is applied, which saves a second
+    // pass over the disk; the exact error is computed once at the end.
+    // False if a shard could not be read
+    bool trainStreamedGradient() {
+        syncQuantizedWeights();
+        GradientState state = makeGradientState();
+        std::vector<size_t> shard_order(m_shard_store->shardCount());
+        for (size_t i = 0; i < shard_order.size(); i++)
+            shard_order[i] = i;
+        std::vector<size_t> order;
+        Shard shard;
+
+        for (size_t epoch = 0; epoch < m_epochs; epoch++) {
+            const auto epoch_start = std::chrono::steady_clock::now();
+            for (size_t i = shard_order.size(); i > 1; i--)
+                std::swap(shard_order[i - 1], shard_order[static_cast<size_t>(rng() * i) % i]);
+
+            ShardStream shard_stream(*m_shard_store, shard_order,
+                m_shard_remapped_columns, SHARD_READ_AHEAD);
+            double epoch_error = 0.0;
+            while (shard_stream.next(shard)) {
+                // Shuffling any permutation gives a uniform one, so the order
+                // only has to be reset when the shard size changes
+                if (order.size() != shard.expected_scores.size()) {
+                    order.resize(shard.expected_scores.size());
+                    for (size_t i = 0; i < order.size(); i++)
+                        order[i] = i;
+                }
+                for (size_t i = order.size(); i > 1; i--)
+                    std::swap(order[i - 1], order[static_cast<size_t>(rng() * i) % i]);
+
+                for (size_t batch_begin = 0; batch_begin < order.size(); batch_begin += m_batch_size) {
+                    const size_t batch_end = std::min(batch_begin + m_batch_size, order.size());
+                    const float batch_scale = 1.f / static_cast<float>(batch_end - batch_begin);
+
+                    for (size_t i = batch_begin; i < batch_end; i++) {
+                        const CompressedSparseRows::Row features = shard.rows.row(order[i]);
+                        const float residual = scoreFeatures(features)
+                            - clampExpectedScore(shard.expected_scores[order[i]]);
+                        epoch_error += std::fabs(residual);
+                        accumulateGradient(state, features, residual, batch_scale);
+                    }
+                    applyGradientStep(state);
+                }
+            }
+            if (shard_stream.failed())
+                return false;
+
+            m_least_error = epoch_error;
+            m_telemetry.write(Telemetry::Record("epoch")
+                .field("epoch", static_cast<uint64_t>(epoch + 1))
+                .field("training_error", m_least_error)
+                .field("seconds", std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - epoch_start).count())
+                .field("shards", static_cast<uint64_t>(shard_order.size())));
+            std::cout << "Epoch " << epoch + 1 << "/" << m_epochs
+                << " Training Error: " << m_least_error << '\n';
+            if (validate(epoch + 1))
+                break;
+        }
+
+        if (!calculateStreamedError(m_least_error))
+            return false;
+        std::cout << "Least Error: " << m_least_error << std::endl;
+        return true;
+    }
+
+    // Error of m_best_weights over every shard, summed in shard then range
+    // order so it doesn't depend on the thread count. False if a shard could
+    // not be read
+    bool calculateStreamedError(double& error) {
+        syncQuantizedWeights();
+        std::vector<size_t> shard_order(m_shard_store->shardCount());
+        for (size_t i = 0; i < shard_order.size(); i++)
+            shard_order[i] = i;
+        ShardStream shard_stream(*m_shard_store, shard_order,
+            m_shard_remapped_columns, SHARD_READ_AHEAD);
+        Shard shard;
+        double all_errors = 0.0;
+        while (shard_stream.next(shard)) {
+            const size_t parent_count = shard.expected_scores.size();
+            m_range_errors.assign((parent_count + PARENTS_PER_RANGE - 1) / PARENTS_PER_RANGE, 0.0);
+            m_thread_pool->parallelFor(m_range_errors.size(), [this, &shard, parent_count](const size_t range) {
+                const size_t range_end = std::min((range + 1) * PARENTS_PER_RANGE, parent_count);
+                double range_error = 0.0;
+                for (size_t i = range * PARENTS_PER_RANGE; i < range_end; i++) {
+                    const CompressedSparseRows::Row features = shard.rows.row(i);
+                    range_error += calculateError(scoreFeatures(features),
+                        clampExpectedScore(shard.expected_scores[i]));
+                }
+                m_range_errors[range] = range_error;
+            });
+            all_errors += sumRangeErrors();
+        }
+        if (shard_stream.failed())
+            return false;
+        error = all_errors;
+        return true;
+    }
+
+    // Turns the held-out keys into feature indices now that the features are
+    // final and starts the validation thread. Features training never kept
+    // weigh nothing, as in a FrozenModel
+    void startValidator() {
+        if (m_validation_expected_scores.empty())
+            return;
+        CompressedSparseRows rows;
+        std::vector<float> expected_scores;
+        for (size_t i = 0; i < validationParentCount(); i++) {
+            rows.startRow();
+            for (size_t k = m_validation_key_offsets[i]; k < m_validation_key_offsets[i + 1]; k++) {
+                const FeatureKey key = m_validation_keys[k];
+                const auto& [exists, existing_index] = m_feature_table.search(FeatureKeys::withoutSign(key));
+                if (exists)
+                    rows.appendToLastRow(existing_index, FeatureKeys::isNegated(key));
+            }
+            expected_scores.push_back(clampExpectedScore(m_validation_expected_scores[i]));
+        }
+        std::vector<FeatureKey>().swap(m_validation_keys);
+        m_validation_key_offsets.assign(1, 0);
+
+        m_validator.reset(new Validator(std::move(rows), std::move(expected_scores),
+            m_validation_patience, VALIDATION_MIN_IMPROVEMENT));
+        std::cout << "Validating on " << m_validator->parentCount() << " held-out parents" << std::endl;
+    }
+
+    // Hands the current weights to the validation thread and reports what it
+    // has finished since the last call. True once validation has plateaued
+    bool validate(const size_t round) {
+        if (!m_validator)
+            return false;
+        m_validator->submit(round, m_best_weights);
+        for (const Validator::Result& result : m_validator->takeResults()) {
+            m_telemetry.write(Telemetry::Record("validation")
+                .field("round", static_cast<uint64_t>(result.round))
+                .field("validation_error", result.error));
+            std::cout << "Validation Error: " << result.error << " after round " << result.round << '\n';
+        }
+        if (!m_validator->shouldStop())
+            return false;
+        std::cout << "Validation error has stopped improving, stopping after round " << round << std::endl;
+        m_telemetry.write(Telemetry::Record("early_stop").field("round", static_cast<uint64_t>(round)));
+        return true;
+    }
+
+    // Stops the validation thread and goes back to the snapshot that
+    // validated best if the final weights do worse
+    void finishValidation() {
+        if (!m_validator)
+            return;
+        m_validator->finish();
+        const double final_error = m_validator->score(m_best_weights);
+        if (m_validator->bestError() < final_error) {
+            m_best_weights = m_validator->bestWeights();
+            std::cout << "Restored the weights of round " << m_validator->bestRound()
+                << ", validation error " << m_validator->bestError() << " against "
+                << final_error << " at the end" << std::endl;
+        }
+        m_telemetry.write(Telemetry::Record("validation_final")
+            .field("final_error", final_error)
+            .field("best_error", m_validator->bestError())
+            .field("best_round", static_cast<uint64_t>(m_validator->bestRound())));
+        m_validator.reset();
+    }
+
+    // Rates cover the rounds since the previous report. The report's own
+    // full pass is already included in the parents scored and the counters
+    void writeReportRecord(const size_t round, const size_t round_count,
+        const double seconds, const float current_error) {
+        Telemetry::Record record("report");
+        record.field("round", static_cast<uint64_t>(round))
+            .field("rounds_per_second", round_count / seconds)
+            .field("parents_scored_per_second", m_parents_scored / seconds)
+            .field("acceptance_rate", static_cast<double>(m_accepted_rounds) / round_count)
+            .field("least_error", m_least_error)
+            .field("current_error", static_cast<double>(current_error))
+            .field("full_pass_seconds", m_full_pass_seconds)
+            .field("resident_bytes", static_cast<uint64_t>(Telemetry::residentMemoryBytes()))
+            .field("index_bytes", static_cast<uint64_t>(indexMemoryBytes()))
+            .field("weight_bytes", static_cast<uint64_t>(weightMemoryBytes()));
+        if (m_perf_counters.isOpen()) {
+            record.field("full_pass_cycles", m_full_pass_counters.cycles)
+                .field("full_pass_instructions", m_full_pass_counters.instructions)
+                .field("full_pass_cache_misses", m_full_pass_counters.cache_misses);
+        }
+        m_telemetry.write(record);
+        m_telemetry.flush();
+        m_parents_scored = 0;
+        m_accepted_rounds = 0;
+    }
+
+    // Rounds first_round .. m_mutation_rounds - 1 of MUTATION or POPULATION
+    // training, with periodic reports and checkpoints
+    void runMutationRounds(const size_t first_round) {
+        auto report_start = std::chrono::steady_clock::now();
+        auto checkpoint_start = report_start;
+        size_t rounds_since_report = 0;
+        CheckpointWriter checkpoint_writer(Chess::IO::CHECKPOINT_FILE_NAME);
+        for (size_t k = first_round; k < m_mutation_rounds; k++) {
+            const float current_error = m_trainer_type == POPULATION
+                ? performPopulationGeneration()
+                : performWeightMutationsAndSetIfBest();
+            rounds_since_report++;
+
+            const auto round_end = std::chrono::steady_clock::now();
+            const bool rounds_due = m_checkpoint_interval_rounds > 0
+                && (k + 1) % m_checkpoint_interval_rounds == 0;
+            const bool seconds_due = m_checkpoint_interval_seconds > 0.0 && std::chrono::duration<double>(
+                round_end - checkpoint_start).count() >= m_checkpoint_interval_seconds;
+            if (rounds_due) {
+                // A resumed run starts from freshly computed scores, so resync
+                // here too and both carry on from the same state
+                resetCachedScores();
+                migrateBestIsland();
+            }
+            if (rounds_due || seconds_due) {
+                // The seconds trigger only takes a snapshot, so how fast the
+                // machine runs never changes the training itself
+                checkpoint_writer.submit(snapshot(k));
+                checkpoint_start = round_end;
+            }
             if (k % static_cast<size_t>((m_mutation_rounds / 100)) == 0) {
-                const ShapeFeature hidden_parent_shape_feature{
-                    Chess::BoardProperties::CHESS_BOARD_PROPERTIES,
-                    FEN::positionStringToCharSequence("r1b1kbnr/n1q1pppp/pp1p4/2pP4/2P1PP2/2NBBN2/PP4PP/R2QK2R")
-                };
+                const auto report_end = std::chrono::steady_clock::now();
+                const double report_seconds = std::chrono::duration<double>(
+                    report_end - report_start).count();
+                const double round_seconds = report_seconds / rounds_since_report;
 
-                std::cout << "Hidden Board Score: " 
-                    << scoreHiddenParentShapeFeature(hidden_parent_shape_feature) << std::endl;
+                // Islands pick up the resynced scores, which quantized are
+                // also on the new scale
+                resetCachedScores();
+                migrateBestIsland();
+                writeReportRecord(k, rounds_since_report, report_seconds, current_error);
+                report_start = report_end;
+                rounds_since_report = 0;
+                std::cout << "Round: " << round_seconds * 1000.0 << " ms, full pass: "
+                    << m_full_pass_seconds * 1000.0 << " ms on "
+                    << m_thread_pool->threadCount() << " threads" << '\n';
                 std::cout << "Least Error: " 
                     << (m_least_error) << std::endl;
+                if (validate(k))
+                    break;
             }
         }
+    }
+
+    // Total error of m_best_weights over every parent, in memory or streamed
+    bool calculateTotalError(double& error) {
+        if (isStreaming())
+            return calculateStreamedError(error);
+        calculateAllErrors();
+        error = sumRangeErrors();
+        return true;
+    }
+
+    // Compares the quantized scores against the float ones they stand for
+    void reportQuantizationError() {
+        if (!m_quantized_scoring)
+            return;
+        syncQuantizedWeights();
+        const QuantizedWeights::Error weight_error = m_quantized_weights.error(m_best_weights);
+        double quantized_error = 0.0;
+        double float_error = 0.0;
+        bool is_scored = calculateTotalError(quantized_error);
+        m_quantized_scoring = false;
+        is_scored = is_scored && calculateTotalError(float_error);
+        m_quantized_scoring = true;
+        if (!is_scored)
+            return;
+
+        std::cout << "Quantized to int16 steps of " << m_quantized_weights.scale()
+            << ": weight error max " << weight_error.max_weight_error << ", mean "
+            << weight_error.mean_weight_error << ", total error " << quantized_error
+            << " against " << float_error << " in float" << std::endl;
+        m_telemetry.write(Telemetry::Record("quantization")
+            .field("scale", static_cast<double>(m_quantized_weights.scale()))
+            .field("max_weight_error", weight_error.max_weight_error)
+            .field("mean_weight_error", weight_error.mean_weight_error)
+            .field("quantized_error", quantized_error)
+            .field("float_error", float_error)
+            .field("quantized_weight_bytes", static_cast<uint64_t>(m_quantized_weights.memoryBytes()))
+            .field("float_weight_bytes", static_cast<uint64_t>(m_best_weights.capacity() * sizeof(float))));
+    }
+
+    void finishTraining() {
+        finishValidation();
+        reportQuantizationError();
         IO::writeFloatVectorToFile(m_best_weights, "BestWeights.txt");
+        saveModel(Chess::IO::MODEL_FILE_NAME);
+    }
+
+    void train() {
+        // Opened here so the counters cover the pool's worker threads
+        m_perf_counters.open();
+        auto phase_start = std::chrono::steady_clock::now();
+        const auto endPhase = [this, &phase_start](std::string_view name) {
+            const auto phase_end = std::chrono::steady_clock::now();
+            m_telemetry.phase(name, std::chrono::duration<double>(phase_end - phase_start).count());
+            phase_start = phase_end;
+        };
+
+        if (isStreaming()) {
+            flushShard();
+            if (m_shard_write_failed) {
+                std::cout << "Not training, some parents never made it into a shard" << std::endl;
+                return;
+            }
+        }
+        pruneRareFeatures();
+        endPhase("prune");
+        if (!loadModelWeights(Chess::IO::MODEL_FILE_NAME))
+            loadBestWeights("BestWeights.txt");
+        startValidator();
+        if (isStreaming()) {
+            // Mutation needs every parent's cached score, which is exactly
+            // what streaming doesn't keep
+            if (m_trainer_type != SGD && m_trainer_type != ADAM) {
+                std::cout << "Streaming trains with SGD, the other trainers need every parent in memory"
+                    << std::endl;
+                m_trainer_type = SGD;
+            }
+            std::cout << "Streaming " << parentCount() << " parents from "
+                << m_shard_store->shardCount() << " shards" << std::endl;
+            if (!trainStreamedGradient()) {
+                std::cout << "Training stopped, a shard could not be read" << std::endl;
+                return;
+            }
+            endPhase("train");
+            finishTraining();
+            return;
+        }
+        buildFeatureParentsMap();
+        endPhase("build_feature_parents_map");
+        if (m_trainer_type == SGD || m_trainer_type == ADAM) {
+            resetCachedScores();
+            endPhase("initial_full_pass");
+            trainGradient();
+            endPhase("train");
+            finishTraining();
+            return;
+        }
+        const size_t first_round = resumeFromCheckpoint(Chess::IO::CHECKPOINT_FILE_NAME);
+        resetCachedScores();
+        migrateBestIsland();
+        endPhase("initial_full_pass");
+        m_parents_scored = 0;
+        m_accepted_rounds = 0;
+        runMutationRounds(first_round);
+        endPhase("train");
+        finishTraining();
 
-        
+        // The finished model supersedes it, a later run starts a fresh schedule
+        std::error_code error;
+        std::filesystem::remove(Chess::IO::CHECKPOINT_FILE_NAME, error);
     }
-};
\ No newline at end of file
+};
@@ -1,6 +1,8 @@
 #pragma once
 #include <algorithm>
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "ShapeFeature.hpp"
 #include "Utility.hpp"
@@ -9,7 +11,7 @@ class FEN {
 
 public:
 
-    static const std::vector<char> positionStringToCharSequence(const std::string& fen) {
+    static const std::vector<char> positionStringToCharSequence(std::string_view fen) {
         std::string board(64, ' ');
 
         int rank = 7, file = 0;
@@ -34,20 +36,28 @@ public:
         return Utility::stringToCharVector(board);
     }
 
-    static float evalStringToFloat(const std::string& s) {
+    static float evalStringToFloat(std::string_view s) {
+        if (s.empty())
+            return 0.f;
         switch (s[0]) {
         case '+':
-            return std::stoi(s.substr(1));
+            return parseUnsigned(s.substr(1));
         case '-':
-            return -std::stoi(s.substr(1));
+            return -parseUnsigned(s.substr(1));
         case '#':
-            if (s[1] == '+')
+            if (s.size() > 1 && s[1] == '+')
                 return 1000.f; 
             return -1000.f;
         }
         return 0.f;
     }
 
+    static float parseUnsigned(std::string_view s) {
+        int value = 0;
+        std::from_chars(s.data(), s.data() + s.size(), value);
+        return static_cast<float>(value);
+    }
+
     // Parses a signed integer from a std::string that includes "+, -, and #" chess notation to indicate engine evaluation score
     static float parseEvalScore(std::string evalscore) {
         if (evalscore[0] == '#') { // Checkmate in X moves
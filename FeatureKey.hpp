@@ -0,0 +1,147 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Utility.hpp"
+#include "Defs.hpp"
+
+// A shape feature packed into one 64-bit integer
+//   bits  0-1   shape type
+//   bits  2-4   width - 1
+//   bits  5-7   height - 1
+//   bits  8-10  offset x
+//   bits 11-13  offset y
+//   bits 14-61  4-bit piece codes, for features of up to 12 squares
+// Larger features set bit 63 and keep a 49-bit hash of their piece codes in bits 14-62
+using FeatureKey = uint64_t;
+
+namespace FeatureKeys {
+    static constexpr size_t TYPE_SHIFT = 0;
+    static constexpr size_t WIDTH_SHIFT = 2;
+    static constexpr size_t HEIGHT_SHIFT = 5;
+    static constexpr size_t OFFSET_X_SHIFT = 8;
+    static constexpr size_t OFFSET_Y_SHIFT = 11;
+    static constexpr size_t CONTENT_SHIFT = 14;
+    static constexpr size_t CODE_BITS = 4;
+    static constexpr size_t MAX_EXACT_SQUARES = 12;
+    static constexpr size_t HASH_BITS = 49;
+
+    static constexpr FeatureKey HEADER_MASK = (1ull << CONTENT_SHIFT) - 1;
+    static constexpr FeatureKey HASHED_FLAG = 1ull << 63;
+    // Never produced by a real feature since it encodes shape type 3
+    static constexpr FeatureKey EMPTY_KEY = ~0ull;
+    // Shape type 2, which no shape uses either. Only set by
+    // Bitboard::forEachSymmetricFeatureKey on a feature that counts with the
+    // negated weight of the key without the flag
+    static constexpr FeatureKey NEGATED_FLAG = 2ull << TYPE_SHIFT;
+
+    // Odd multipliers so that their powers stay invertible modulo 2^64
+    static constexpr uint64_t ROW_BASE = 0x9E3779B97F4A7C15ull;
+    static constexpr uint64_t COLUMN_BASE = 0xC2B2AE3D27D4EB4Full;
+
+    // Inverse of an odd number modulo 2^64 by Newton iteration, each step
+    // doubling the number of correct low bits
+    static constexpr uint64_t inverse(const uint64_t odd) {
+        uint64_t result = odd;
+        for (size_t i = 0; i < 5; i++)
+            result *= 2 - odd * result;
+        return result;
+    }
+
+    static constexpr uint64_t ROW_BASE_INVERSE = inverse(ROW_BASE);
+    static constexpr uint64_t COLUMN_BASE_INVERSE = inverse(COLUMN_BASE);
+    static_assert(ROW_BASE * ROW_BASE_INVERSE == 1, "ROW_BASE must be odd");
+    static_assert(COLUMN_BASE * COLUMN_BASE_INVERSE == 1, "COLUMN_BASE must be odd");
+
+    static constexpr FeatureKey header(const size_t type, const size_t width,
+        const size_t height, const size_t offset_x, const size_t offset_y) {
+        return (static_cast<FeatureKey>(type) << TYPE_SHIFT)
+            | (static_cast<FeatureKey>(width - 1) << WIDTH_SHIFT)
+            | (static_cast<FeatureKey>(height - 1) << HEIGHT_SHIFT)
+            | (static_cast<FeatureKey>(offset_x) << OFFSET_X_SHIFT)
+            | (static_cast<FeatureKey>(offset_y) << OFFSET_Y_SHIFT);
+    }
+
+    static constexpr size_t width(const FeatureKey key) {
+        return ((key >> WIDTH_SHIFT) & 7) + 1;
+    }
+
+    static constexpr size_t height(const FeatureKey key) {
+        return ((key >> HEIGHT_SHIFT) & 7) + 1;
+    }
+
+    static constexpr size_t offsetX(const FeatureKey key) {
+        return (key >> OFFSET_X_SHIFT) & 7;
+    }
+
+    static constexpr size_t offsetY(const FeatureKey key) {
+        return (key >> OFFSET_Y_SHIFT) & 7;
+    }
+
+    static constexpr bool isHashed(const FeatureKey key) {
+        return (key & HASHED_FLAG) != 0;
+    }
+
+    static constexpr bool isNegated(const FeatureKey key) {
+        return (key & NEGATED_FLAG) != 0;
+    }
+
+    // The key the feature's weight is stored under
+    static constexpr FeatureKey withoutSign(const FeatureKey key) {
+        return key & ~NEGATED_FLAG;
+    }
+
+    static constexpr uint8_t pieceCode(const FeatureKey key, const size_t square) {
+        return static_cast<uint8_t>((key >> (CONTENT_SHIFT + square * CODE_BITS)) & 0xF);
+    }
+
+    // splitmix64 finalizer, a bijection on 64-bit integers
+    static constexpr uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static constexpr FeatureKey fromContentHash(const FeatureKey header_bits,
+        const uint64_t content_hash) {
+        return HASHED_FLAG | header_bits
+            | ((mix(content_hash) & ((1ull << HASH_BITS) - 1)) << CONTENT_SHIFT);
+    }
+
+    // Squares are laid out as decomposeIntoSubquadrillaterals emits them: square
+    // (i, j) of a width x height feature sits at index i * height + j. Large
+    // features hash to sum(code * ROW_BASE^i * COLUMN_BASE^j), which a rolling
+    // decomposition can reproduce without visiting every square
+    static FeatureKey pack(const size_t type, const size_t width, const size_t height,
+        const size_t offset_x, const size_t offset_y, const char* char_sequence) {
+        using namespace Chess::LookupTables;
+        const FeatureKey header_bits = header(type, width, height, offset_x, offset_y);
+
+        if (width * height <= MAX_EXACT_SQUARES) {
+            FeatureKey key = header_bits;
+            for (size_t square = 0; square < width * height; square++)
+                key |= static_cast<FeatureKey>(PIECE_CODE(char_sequence[square]))
+                    << (CONTENT_SHIFT + square * CODE_BITS);
+            return key;
+        }
+
+        uint64_t content_hash = 0;
+        uint64_t row_power = 1;
+        for (size_t i = 0; i < width; i++) {
+            uint64_t power = row_power;
+            for (size_t j = 0; j < height; j++) {
+                content_hash += PIECE_CODE(char_sequence[i * height + j]) * power;
+                power *= COLUMN_BASE;
+            }
+            row_power *= ROW_BASE;
+        }
+        return fromContentHash(header_bits, content_hash);
+    }
+
+    static FeatureKey pack(const size_t type, const size_t width, const size_t height,
+        const size_t offset_x, const size_t offset_y, const std::vector<char>& char_sequence) {
+        return pack(type, width, height, offset_x, offset_y, char_sequence.data());
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "FeatureKey.hpp"
+
+// Open addressing hash table from packed feature keys to weight indices.
+// Linear probing over 16-byte slots keeps a lookup to one or two cache lines
+class FeatureTable {
+private:
+    static constexpr size_t INITIAL_CAPACITY = 1024;
+    static constexpr size_t MAX_LOAD_PERCENT = 50;
+
+    struct Slot {
+        FeatureKey key;
+        uint32_t value;
+    };
+
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    size_t m_size;
+
+public:
+    FeatureTable() :
+        m_slots(INITIAL_CAPACITY, Slot{ FeatureKeys::EMPTY_KEY, 0 }),
+        m_mask(INITIAL_CAPACITY - 1),
+        m_size(0)
+    {}
+
+    void insert(const FeatureKey key, const size_t value) {
+        if ((m_size + 1) * 100 > m_slots.size() * MAX_LOAD_PERCENT)
+            grow();
+        Slot& slot = m_slots[probe(key)];
+        if (slot.key == FeatureKeys::EMPTY_KEY)
+            m_size++;
+        slot.key = key;
+        slot.value = static_cast<uint32_t>(value);
+    }
+
+    std::pair<bool, size_t> search(const FeatureKey key) const {
+        const Slot& slot = m_slots[probe(key)];
+        if (slot.key == FeatureKeys::EMPTY_KEY)
+            return { false, 0 };
+        return { true, slot.value };
+    }
+
+    void clear() {
+        m_slots.assign(INITIAL_CAPACITY, Slot{ FeatureKeys::EMPTY_KEY, 0 });
+        m_mask = INITIAL_CAPACITY - 1;
+        m_size = 0;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    size_t memoryBytes() const {
+        return m_slots.capacity() * sizeof(Slot);
+    }
+
+private:
+    // Index of the slot holding key, or of the empty slot where it would go
+    size_t probe(const FeatureKey key) const {
+        size_t index = FeatureKeys::mix(key) & m_mask;
+        while (m_slots[index].key != key && m_slots[index].key != FeatureKeys::EMPTY_KEY)
+            index = (index + 1) & m_mask;
+        return index;
+    }
+
+    void grow() {
+        std::vector<Slot> old_slots(m_slots.size() * 2, Slot{ FeatureKeys::EMPTY_KEY, 0 });
+        old_slots.swap(m_slots);
+        m_mask = m_slots.size() - 1;
+        for (const Slot& slot : old_slots)
+            if (slot.key != FeatureKeys::EMPTY_KEY)
+                m_slots[probe(slot.key)] = slot;
+    }
+};
@@ -1,73 +1,62 @@
 #include "FixedPoint.h"
-#include <fstream>
+#include <algorithm>
+#include <thread>
 
-FixedPoint<256 * 256> _sinLookupTable16[256 * 256 * 2 * _FP_MAX_SIN_INPUT];
-FixedPoint<256 * 256> _cosinLookupTable16[256 * 256 * 2 * _FP_MAX_SIN_INPUT];
-FixedPoint<256> _sinLookupTable8[256 * 2 * _FP_MAX_SIN_INPUT];
-FixedPoint<256> _cosinLookupTable8[256 * 2 * _FP_MAX_SIN_INPUT];
+namespace {
+	struct Tables16 {
+		FixedPointTables::Table16 sin;
+		FixedPointTables::Table16 cos;
+	};
 
-void initFixedPointUtilities() {
-	std::string path = "./data/lookupTables/sin16_7.txt";
-	std::ifstream file;
-	file.open(path);
-	if (file.is_open() == false) {
-		std::cout << "Error: initFixedPointUtilities() couldn't access file " << path;
-		throw;
-	}
-	std::string line;
-	uint32_t i = 0;
-	while (getline(file, line)) {
-		FixedPoint<256 * 256> fp;
-		if (fp.fromString(line)) {
-			std::cout << "Error: initFixedPointUtilities() input file is invalid reading " << line;
-			throw;
+	// Every thread fills its own slice of both tables. Angles and results stay
+	// in double until rounded to the nearest step, as for the 8-bit tables,
+	// since a float sin can land on the other side of a half step
+	Tables16 generateTables16() {
+		const uint32_t lastValue = FixedPointTables::lastValue<256 * 256>();
+		Tables16 tables;
+		tables.sin.resize(FixedPointTables::tableSize<256 * 256>());
+		tables.cos.resize(FixedPointTables::tableSize<256 * 256>());
+
+		const uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		std::vector<std::thread> workers;
+		for (uint32_t t = 0; t < threadCount; t++) {
+			workers.emplace_back([&tables, lastValue, threadCount, t]() {
+				const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(lastValue + 1) * t / threadCount);
+				const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(lastValue + 1) * (t + 1) / threadCount);
+				for (uint32_t i = begin; i < end; i++) {
+					const double angle = static_cast<double>(i) / (256 * 256);
+					const double sinValue = std::sin(angle);
+					const double cosValue = std::cos(angle);
+					tables.sin[i].setRaw(FixedPointTables::roundToRaw<256 * 256>(sinValue));
+					tables.cos[i].setRaw(FixedPointTables::roundToRaw<256 * 256>(cosValue));
+					if (i > 0) {
+						tables.sin[lastValue + i].setRaw(FixedPointTables::roundToRaw<256 * 256>(-sinValue));
+						tables.cos[lastValue + i].setRaw(FixedPointTables::roundToRaw<256 * 256>(cosValue));
+					}
+				}
+			});
 		}
-		_sinLookupTable16[i] = fp;
-		i++;
-	}
-	file.close();
-	path = "./data/lookupTables/cosin16_t.txt";
-	file.open(path);
-	if (file.is_open() == false) {
-		std::cout << "Error: initFixedPointUtilities() couldn't access file " << path;
-		throw;
+		for (std::thread& worker : workers)
+			worker.join();
+		return tables;
 	}
-	line;
-	i = 0;
-	while (getline(file, line)) {
-		FixedPoint<256 * 256> fp;
-		if (fp.fromString(line)) {
-			std::cout << "Error: initFixedPointUtilities() input file is invalid reading " << line;
-			throw;
-		}
-		_cosinLookupTable16[i] = fp;
-		i++;
+
+	// Built on first use, a function local static is initialised exactly once
+	// even when several threads ask at the same time
+	const Tables16& tables16() {
+		static const Tables16 tables = generateTables16();
+		return tables;
 	}
-	file.close();
 }
 
-void setupFixedPointTableFiles() {
-	FixedPoint<256 * 256> min = -_FP_MAX_SIN_INPUT, max = _FP_MAX_SIN_INPUT;
-	uint32_t lastValue = max.getRaw();
-	for (uint32_t i = 0; i <= lastValue; i++) {
-		FixedPoint<256 * 256> fp;
-		fp.setRaw(i);
-		float asFloat = fp.getAsFloat();
-		float result = sin(asFloat);
-		_sinLookupTable16[i] = result;
-		result = cos(asFloat);
-		_cosinLookupTable16[i] = result;
-	}
-	uint32_t startingIndex = lastValue + 1;
-	uint32_t endingIndex = lastValue + lastValue;
-	for (uint32_t i = startingIndex; i <= endingIndex; i++) {
-		FixedPoint<256 * 256> fp;
-		fp.setRaw(i-startingIndex);
-		float asFloat = fp.getAsFloat();
-		asFloat = -asFloat;
-		float result = sin(asFloat);
-		_sinLookupTable16[i] = result;
-		result = cos(asFloat);
-		_cosinLookupTable16[i] = result;
-	}
-}
\ No newline at end of file
+const FixedPointTables::Table16& sinLookupTable16() {
+	return tables16().sin;
+}
+
+const FixedPointTables::Table16& cosinLookupTable16() {
+	return tables16().cos;
+}
+
+void initFixedPointUtilities() {
+	tables16();
+}
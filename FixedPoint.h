@@ -0,0 +1,218 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Largest magnitude, in radians, the sin/cos lookup tables cover
+#define _FP_MAX_SIN_INPUT 7
+
+// Signed fixed point number with N steps per unit, stored as a 32-bit raw
+// value. N is a power of two in practice (256 for 8 fractional bits, 256 * 256
+// for 16), but any positive step count works
+template <uint32_t N>
+class FixedPoint {
+	static_assert(N > 0, "FixedPoint needs at least one step per unit");
+
+public:
+	using Raw = int32_t;
+
+	constexpr FixedPoint() : m_raw(0) {}
+
+	constexpr FixedPoint(const int value) : m_raw(static_cast<Raw>(static_cast<int64_t>(value) * N)) {}
+
+	FixedPoint& operator=(const float value) {
+		m_raw = fromFloat(value);
+		return *this;
+	}
+
+	constexpr Raw getRaw() const {
+		return m_raw;
+	}
+
+	constexpr void setRaw(const Raw raw) {
+		m_raw = raw;
+	}
+
+	constexpr float getAsFloat() const {
+		return static_cast<float>(m_raw) / static_cast<float>(N);
+	}
+
+	// Parses a decimal number such as "-0.7071". Returns true on error, leaving
+	// the value unchanged
+	bool fromString(const std::string& text) {
+		if (text.empty())
+			return true;
+		char* end = nullptr;
+		const double value = std::strtod(text.c_str(), &end);
+		while (end != nullptr && (*end == ' ' || *end == '\r' || *end == '\t'))
+			end++;
+		if (end == text.c_str() || *end != '\0' || !std::isfinite(value)
+			|| std::fabs(value * N) > static_cast<double>(std::numeric_limits<Raw>::max()))
+			return true;
+		m_raw = static_cast<Raw>(std::lround(value * N));
+		return false;
+	}
+
+	std::string toString() const {
+		return std::to_string(getAsFloat());
+	}
+
+	FixedPoint operator-() const {
+		return fromRaw(-m_raw);
+	}
+
+	FixedPoint operator+(const FixedPoint& other) const {
+		return fromRaw(m_raw + other.m_raw);
+	}
+
+	FixedPoint operator-(const FixedPoint& other) const {
+		return fromRaw(m_raw - other.m_raw);
+	}
+
+	// Rounds the product to the nearest step
+	FixedPoint operator*(const FixedPoint& other) const {
+		const int64_t product = static_cast<int64_t>(m_raw) * other.m_raw;
+		return fromRaw(static_cast<Raw>((product + (product >= 0 ? N / 2 : -static_cast<int64_t>(N / 2))) / N));
+	}
+
+	FixedPoint& operator+=(const FixedPoint& other) {
+		m_raw += other.m_raw;
+		return *this;
+	}
+
+	FixedPoint& operator-=(const FixedPoint& other) {
+		m_raw -= other.m_raw;
+		return *this;
+	}
+
+	bool operator==(const FixedPoint& other) const { return m_raw == other.m_raw; }
+	bool operator!=(const FixedPoint& other) const { return m_raw != other.m_raw; }
+	bool operator<(const FixedPoint& other) const { return m_raw < other.m_raw; }
+	bool operator<=(const FixedPoint& other) const { return m_raw <= other.m_raw; }
+	bool operator>(const FixedPoint& other) const { return m_raw > other.m_raw; }
+	bool operator>=(const FixedPoint& other) const { return m_raw >= other.m_raw; }
+
+	static constexpr FixedPoint fromRaw(const Raw raw) {
+		FixedPoint result;
+		result.m_raw = raw;
+		return result;
+	}
+
+	// Rounds to the nearest step, saturating at the ends of the range
+	static Raw fromFloat(const float value) {
+		const double scaled = std::round(static_cast<double>(value) * N);
+		if (scaled >= static_cast<double>(std::numeric_limits<Raw>::max()))
+			return std::numeric_limits<Raw>::max();
+		if (scaled <= static_cast<double>(std::numeric_limits<Raw>::min()))
+			return std::numeric_limits<Raw>::min();
+		return static_cast<Raw>(scaled);
+	}
+
+private:
+	Raw m_raw;
+};
+
+// sin and cos tables for every step of a FixedPoint<N> in
+// [-_FP_MAX_SIN_INPUT, _FP_MAX_SIN_INPUT]. Raw values 0 .. lastValue come
+// first, then -1 .. -lastValue, so a table has 2 * lastValue + 1 entries
+namespace FixedPointTables {
+	template <uint32_t N>
+	constexpr uint32_t lastValue() {
+		return _FP_MAX_SIN_INPUT * N;
+	}
+
+	template <uint32_t N>
+	constexpr size_t tableSize() {
+		return 2 * static_cast<size_t>(lastValue<N>()) + 1;
+	}
+
+	template <uint32_t N>
+	constexpr size_t tableIndex(const FixedPoint<N> x) {
+		const int64_t raw = x.getRaw();
+		return static_cast<size_t>(raw >= 0 ? raw : lastValue<N>() - raw);
+	}
+
+	// Taylor series, exact to double precision for the one small step they
+	// are used for
+	constexpr double sinSeries(const double x) {
+		double term = x, sum = x;
+		for (int k = 1; k < 10; k++) {
+			term *= -x * x / ((2 * k) * (2 * k + 1));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double cosSeries(const double x) {
+		double term = 1.0, sum = 1.0;
+		for (int k = 1; k < 10; k++) {
+			term *= -x * x / ((2 * k - 1) * (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	template <uint32_t N>
+	constexpr typename FixedPoint<N>::Raw roundToRaw(const double value) {
+		using Raw = typename FixedPoint<N>::Raw;
+		return value >= 0.0 ? static_cast<Raw>(value * N + 0.5) : -static_cast<Raw>(-value * N + 0.5);
+	}
+
+	// Steps the angle up by 1 / N at a time with the angle addition formulas,
+	// since std::sin isn't constexpr. The drift over the 8-bit range stays
+	// many orders of magnitude below one step
+	template <uint32_t N>
+	constexpr std::array<FixedPoint<N>, tableSize<N>()> makeTable(const bool is_sin) {
+		std::array<FixedPoint<N>, tableSize<N>()> table{};
+		const double sin_step = sinSeries(1.0 / N);
+		const double cos_step = cosSeries(1.0 / N);
+		double sin_value = 0.0, cos_value = 1.0;
+		for (uint32_t i = 0; i <= lastValue<N>(); i++) {
+			const double value = is_sin ? sin_value : cos_value;
+			table[i].setRaw(roundToRaw<N>(value));
+			if (i > 0)
+				table[lastValue<N>() + i].setRaw(roundToRaw<N>(is_sin ? -value : value));
+			const double next_sin_value = sin_value * cos_step + cos_value * sin_step;
+			cos_value = cos_value * cos_step - sin_value * sin_step;
+			sin_value = next_sin_value;
+		}
+		return table;
+	}
+
+	using Table8 = std::array<FixedPoint<256>, tableSize<256>()>;
+	using Table16 = std::vector<FixedPoint<256 * 256>>;
+}
+
+inline constexpr FixedPointTables::Table8 _sinLookupTable8 = FixedPointTables::makeTable<256>(true);
+inline constexpr FixedPointTables::Table8 _cosinLookupTable8 = FixedPointTables::makeTable<256>(false);
+
+// The 16-bit tables are too large to build at compile time, they are computed
+// on all cores the first time one is used. Defined in FixedPoint.cpp
+const FixedPointTables::Table16& sinLookupTable16();
+const FixedPointTables::Table16& cosinLookupTable16();
+
+// x has to lie within +-_FP_MAX_SIN_INPUT
+inline FixedPoint<256> fixedPointSin(const FixedPoint<256> x) {
+	return _sinLookupTable8[FixedPointTables::tableIndex(x)];
+}
+
+inline FixedPoint<256> fixedPointCos(const FixedPoint<256> x) {
+	return _cosinLookupTable8[FixedPointTables::tableIndex(x)];
+}
+
+inline FixedPoint<256 * 256> fixedPointSin(const FixedPoint<256 * 256> x) {
+	return sinLookupTable16()[FixedPointTables::tableIndex(x)];
+}
+
+inline FixedPoint<256 * 256> fixedPointCos(const FixedPoint<256 * 256> x) {
+	return cosinLookupTable16()[FixedPointTables::tableIndex(x)];
+}
+
+// Builds the 16-bit tables up front instead of on first use
+void initFixedPointUtilities();
@@ -0,0 +1,219 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "ShapeFeature.hpp"
+#include "FeatureKey.hpp"
+#include "Defs.hpp"
+
+// Offsets of a feature inside the board or a larger feature, shared by all sizes
+struct FeaturePlacement {
+    uint8_t offset_x;
+    uint8_t offset_y;
+};
+
+// A ShapeFeature whose size is part of its type: W ranks by H files. The
+// squares live in a std::array laid out as decomposeIntoSubquadrillaterals
+// and FeatureKeys::pack read them, square (i, j) at i * H + j, and the
+// placements and square offsets come from constexpr tables. Containment,
+// serialization and decomposition then loop a fixed number of times and
+// never allocate.
+// Boards are 64 chars, square rank * 8 + file, as from
+// FEN::positionStringToCharSequence
+template <size_t W, size_t H>
+class FixedShapeFeature {
+public:
+    static_assert(W >= 1 && W <= Chess::BoardProperties::CHESS_BOARD_WIDTH
+        && H >= 1 && H <= Chess::BoardProperties::CHESS_BOARD_HEIGHT,
+        "A feature has to fit on the board");
+
+    static constexpr size_t WIDTH = W;
+    static constexpr size_t HEIGHT = H;
+    static constexpr size_t AREA = W * H;
+    static constexpr size_t SERIALIZED_LENGTH = SERIALIZED_FORMAT::LENGTH + AREA;
+
+    using Squares = std::array<char, AREA>;
+    using Serialized = std::array<char, SERIALIZED_LENGTH>;
+
+    using Placement = FeaturePlacement;
+
+    // Every placement inside a parent_width x parent_height rectangle, in the
+    // order of decomposeIntoSubquadrillaterals
+    template <size_t PARENT_WIDTH, size_t PARENT_HEIGHT>
+    static constexpr std::array<Placement, (PARENT_WIDTH - W + 1) * (PARENT_HEIGHT - H + 1)>
+        placementsWithin() {
+        std::array<Placement, (PARENT_WIDTH - W + 1) * (PARENT_HEIGHT - H + 1)> placements{};
+        size_t index = 0;
+        for (size_t y = 0; y + H <= PARENT_HEIGHT; y++)
+            for (size_t x = 0; x + W <= PARENT_WIDTH; x++)
+                placements[index++] = Placement{ static_cast<uint8_t>(x), static_cast<uint8_t>(y) };
+        return placements;
+    }
+
+    static constexpr auto BOARD_PLACEMENTS = placementsWithin<
+        Chess::BoardProperties::CHESS_BOARD_WIDTH, Chess::BoardProperties::CHESS_BOARD_HEIGHT>();
+
+    // Board square of every feature square when the feature sits at (0, 0),
+    // add offset_x * 8 + offset_y for any other placement
+    static constexpr std::array<uint8_t, AREA> BOARD_SQUARE_OFFSETS = []() {
+        std::array<uint8_t, AREA> offsets{};
+        for (size_t i = 0; i < W; i++)
+            for (size_t j = 0; j < H; j++)
+                offsets[i * H + j] = static_cast<uint8_t>(i * Chess::BoardProperties::CHESS_BOARD_HEIGHT + j);
+        return offsets;
+    }();
+
+    constexpr FixedShapeFeature() :
+        m_squares(emptySquares()),
+        m_offset_x(0),
+        m_offset_y(0)
+    {}
+
+    constexpr FixedShapeFeature(const Placement placement, const Squares& squares) :
+        m_squares(squares),
+        m_offset_x(placement.offset_x),
+        m_offset_y(placement.offset_y)
+    {}
+
+    // The squares of the board under the placement
+    static FixedShapeFeature fromBoard(const char* board, const Placement placement) {
+        const size_t corner = placement.offset_x * Chess::BoardProperties::CHESS_BOARD_HEIGHT
+            + placement.offset_y;
+        Squares squares;
+        for (size_t square = 0; square < AREA; square++)
+            squares[square] = board[corner + BOARD_SQUARE_OFFSETS[square]];
+        return FixedShapeFeature(placement, squares);
+    }
+
+    // Reads what serialized writes. False if the string is too short, is for
+    // another size or places the feature partly off the board
+    static std::pair<FixedShapeFeature, bool> fromSerialized(std::string_view serialized) {
+        if (serialized.size() < SERIALIZED_LENGTH
+            || serialized[WIDTH_POS] != static_cast<char>('0' + W)
+            || serialized[HEIGHT_POS] != static_cast<char>('0' + H)
+            || !isOffsetChar(serialized[OFFSET_X_POS], 8 - W)
+            || !isOffsetChar(serialized[OFFSET_Y_POS], 8 - H))
+            return { FixedShapeFeature(), false };
+        Squares squares;
+        for (size_t square = 0; square < AREA; square++)
+            squares[square] = serialized[LENGTH + square];
+        const Placement placement{ static_cast<uint8_t>(serialized[OFFSET_X_POS] - '0'),
+            static_cast<uint8_t>(serialized[OFFSET_Y_POS] - '0') };
+        return { FixedShapeFeature(placement, squares), true };
+    }
+
+    constexpr size_t offset_x() const {
+        return m_offset_x;
+    }
+
+    constexpr size_t offset_y() const {
+        return m_offset_y;
+    }
+
+    constexpr char at(const size_t i, const size_t j) const {
+        return m_squares[i * H + j];
+    }
+
+    constexpr const Squares& squares() const {
+        return m_squares;
+    }
+
+    constexpr bool isEmpty() const {
+        bool is_empty = true;
+        for (size_t square = 0; square < AREA; square++)
+            is_empty &= m_squares[square] == ' ';
+        return is_empty;
+    }
+
+    // Whether other, its offsets taken relative to this feature, lies inside
+    // it with the same squares. A larger feature never is, which is settled
+    // at compile time without looking at the squares
+    template <size_t OTHER_WIDTH, size_t OTHER_HEIGHT>
+    constexpr bool contains(const FixedShapeFeature<OTHER_WIDTH, OTHER_HEIGHT>& other) const {
+        if constexpr (OTHER_WIDTH > W || OTHER_HEIGHT > H) {
+            return false;
+        }
+        else {
+            if (other.offset_x() + OTHER_WIDTH > W || other.offset_y() + OTHER_HEIGHT > H)
+                return false;
+            bool matches = true;
+            for (size_t i = 0; i < OTHER_WIDTH; i++)
+                for (size_t j = 0; j < OTHER_HEIGHT; j++)
+                    matches &= at(other.offset_x() + i, other.offset_y() + j) == other.at(i, j);
+            return matches;
+        }
+    }
+
+    // Whether the board has this feature's squares at its placement
+    bool isOn(const char* board) const {
+        const size_t corner = m_offset_x * Chess::BoardProperties::CHESS_BOARD_HEIGHT + m_offset_y;
+        bool matches = true;
+        for (size_t square = 0; square < AREA; square++)
+            matches &= board[corner + BOARD_SQUARE_OFFSETS[square]] == m_squares[square];
+        return matches;
+    }
+
+    // Calls callback(FixedShapeFeature<SUB_WIDTH, SUB_HEIGHT>) for every
+    // placement inside this feature that isn't all empty, offsets relative to
+    // this feature, in the order of decomposeIntoSubquadrillaterals
+    template <size_t SUB_WIDTH, size_t SUB_HEIGHT, typename Callback>
+    void forEachSubrectangle(Callback callback) const {
+        static_assert(SUB_WIDTH <= W && SUB_HEIGHT <= H, "Subrectangles have to fit in the feature");
+        using Subrectangle = FixedShapeFeature<SUB_WIDTH, SUB_HEIGHT>;
+        static constexpr auto placements = Subrectangle::template placementsWithin<W, H>();
+        for (const Placement& placement : placements) {
+            typename Subrectangle::Squares squares;
+            for (size_t i = 0; i < SUB_WIDTH; i++)
+                for (size_t j = 0; j < SUB_HEIGHT; j++)
+                    squares[i * SUB_HEIGHT + j] = at(placement.offset_x + i, placement.offset_y + j);
+            const Subrectangle subrectangle(placement, squares);
+            if (!subrectangle.isEmpty())
+                callback(subrectangle);
+        }
+    }
+
+    // Same layout as ShapeFeature::serialized
+    Serialized serialized() const {
+        Serialized result;
+        result[TYPE_POS] = '0';
+        result[WIDTH_POS] = static_cast<char>('0' + W);
+        result[HEIGHT_POS] = static_cast<char>('0' + H);
+        result[OFFSET_X_POS] = static_cast<char>('0' + m_offset_x);
+        result[OFFSET_Y_POS] = static_cast<char>('0' + m_offset_y);
+        for (size_t square = 0; square < AREA; square++)
+            result[LENGTH + square] = m_squares[square];
+        return result;
+    }
+
+    FeatureKey packedKey() const {
+        return FeatureKeys::pack(GeometricProperties::ShapeType::RECTANGLE, W, H,
+            m_offset_x, m_offset_y, m_squares.data());
+    }
+
+    ShapeFeature toShapeFeature() const {
+        return ShapeFeature({ GeometricProperties::ShapeType::RECTANGLE,
+            { W, H }, { offset_x(), offset_y() } },
+            std::vector<char>(m_squares.begin(), m_squares.end()));
+    }
+
+private:
+    static constexpr Squares emptySquares() {
+        Squares squares{};
+        for (size_t square = 0; square < AREA; square++)
+            squares[square] = ' ';
+        return squares;
+    }
+
+    static constexpr bool isOffsetChar(const char c, const size_t max_offset) {
+        return c >= '0' && static_cast<size_t>(c - '0') <= max_offset;
+    }
+
+    Squares m_squares;
+    uint8_t m_offset_x;
+    uint8_t m_offset_y;
+};
+
+using BoardFeature = FixedShapeFeature<Chess::BoardProperties::CHESS_BOARD_WIDTH,
+    Chess::BoardProperties::CHESS_BOARD_HEIGHT>;
@@ -0,0 +1,288 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Bitboard.hpp"
+#include "FeatureKey.hpp"
+#include "MappedFile.hpp"
+#include "QuantizedWeights.hpp"
+
+// A trained model reduced to what scoring needs: feature keys sorted by their
+// mixed value next to their weights, plus a bucket index on the top bits of
+// the mixed value so a lookup is one bucket read and a short scan. Nothing is
+// mutated after construction, so one instance can be shared by any number of
+// scoring threads.
+//
+// The same three arrays make up the model file, so a saved model is scored
+// straight from the mapped file without rebuilding anything:
+//   Header, FeatureKey[entry_count], float[entry_count],
+//   uint32_t[(1 << bucket_bits) + 1] bucket starts
+// All values are little endian
+class FrozenModel {
+public:
+    static constexpr size_t MIN_BUCKET_BITS = 4;
+    static constexpr size_t MAX_BUCKET_BITS = 24;
+    static constexpr char MAGIC[8] = { 'A', 'T', 'M', 'Z', 'M', 'O', 'D', 'L' };
+    // Bump whenever the FeatureKey layout or its hash changes, old files
+    // would silently look up the wrong features
+    static constexpr uint32_t VERSION = 2;
+    // Header flags
+    static constexpr uint32_t SYMMETRIC_FEATURES = 1;
+    // Every placement of every rectangle on the board, the full board excluded
+    static constexpr size_t MAX_FEATURES_PER_BOARD = 36 * 36 - 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t bucket_bits;
+        uint64_t entry_count;
+        uint32_t max_feature_width;
+        uint32_t max_feature_height;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    static_assert(sizeof(Header) == 40, "Header layout is part of the file format");
+
+    // symmetric_features: the keys came from Bitboard::forEachSymmetricFeatureKey
+    FrozenModel(const std::vector<FeatureKey>& feature_keys, const std::vector<float>& weights,
+        const size_t max_feature_width, const size_t max_feature_height,
+        const bool symmetric_features = false)
+    {
+        const size_t entry_count = std::min(feature_keys.size(), weights.size());
+        std::vector<size_t> order(entry_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&feature_keys](const size_t a, const size_t b) {
+            return FeatureKeys::mix(feature_keys[a]) < FeatureKeys::mix(feature_keys[b]);
+        });
+
+        m_owned_keys.reserve(entry_count);
+        m_owned_weights.reserve(entry_count);
+        for (const size_t i : order) {
+            m_owned_keys.push_back(feature_keys[i]);
+            m_owned_weights.push_back(weights[i]);
+        }
+
+        // About one entry per bucket
+        size_t bucket_bits = MIN_BUCKET_BITS;
+        while (bucket_bits < MAX_BUCKET_BITS && (1ull << bucket_bits) < entry_count)
+            bucket_bits++;
+        m_owned_bucket_starts.assign((1ull << bucket_bits) + 1, 0);
+        for (const FeatureKey key : m_owned_keys)
+            m_owned_bucket_starts[(FeatureKeys::mix(key) >> (64 - bucket_bits)) + 1]++;
+        std::partial_sum(m_owned_bucket_starts.begin(), m_owned_bucket_starts.end(),
+            m_owned_bucket_starts.begin());
+
+        m_header = Header{};
+        std::memcpy(m_header.magic, MAGIC, sizeof(MAGIC));
+        m_header.version = VERSION;
+        m_header.bucket_bits = static_cast<uint32_t>(bucket_bits);
+        m_header.entry_count = entry_count;
+        m_header.max_feature_width = static_cast<uint32_t>(max_feature_width);
+        m_header.max_feature_height = static_cast<uint32_t>(max_feature_height);
+        m_header.flags = symmetric_features ? SYMMETRIC_FEATURES : 0;
+        m_keys = m_owned_keys.data();
+        m_weights = m_owned_weights.data();
+        m_bucket_starts = m_owned_bucket_starts.data();
+        m_is_quantized = false;
+    }
+
+    // Maps a file written by save. Check isValid before scoring
+    FrozenModel(const std::string& filename) :
+        m_header{},
+        m_keys(nullptr),
+        m_weights(nullptr),
+        m_bucket_starts(nullptr),
+        m_is_quantized(false),
+        m_file(new MappedFile(filename))
+    {
+        if (m_file->size() < sizeof(Header))
+            return;
+        Header header;
+        std::memcpy(&header, m_file->data(), sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION
+            || header.bucket_bits < MIN_BUCKET_BITS || header.bucket_bits > MAX_BUCKET_BITS
+            || m_file->size() != fileSize(header))
+            return;
+
+        const char* data = m_file->data() + sizeof(Header);
+        m_header = header;
+        m_keys = reinterpret_cast<const FeatureKey*>(data);
+        m_weights = reinterpret_cast<const float*>(data + header.entry_count * sizeof(FeatureKey));
+        m_bucket_starts = reinterpret_cast<const uint32_t*>(
+            data + header.entry_count * (sizeof(FeatureKey) + sizeof(float)));
+    }
+
+    // Members point into the owned vectors or the mapping, both of which
+    // keep their address when moved
+    FrozenModel(FrozenModel&&) = default;
+    FrozenModel(const FrozenModel&) = delete;
+    FrozenModel& operator=(const FrozenModel&) = delete;
+
+    bool isValid() const {
+        return m_bucket_starts != nullptr;
+    }
+
+    size_t featureCount() const {
+        return static_cast<size_t>(m_header.entry_count);
+    }
+
+    size_t maxFeatureWidth() const {
+        return m_header.max_feature_width;
+    }
+
+    size_t maxFeatureHeight() const {
+        return m_header.max_feature_height;
+    }
+
+    bool hasSymmetricFeatures() const {
+        return (m_header.flags & SYMMETRIC_FEATURES) != 0;
+    }
+
+    size_t memoryBytes() const {
+        return isValid() ? fileSize(m_header) - sizeof(Header) : 0;
+    }
+
+    // Scores with int16 weights from now on. The float weights stay for
+    // weight() and save, the file format doesn't change
+    void quantize() {
+        m_quantized_weights.quantize(std::vector<float>(m_weights, m_weights + featureCount()));
+        m_is_quantized = true;
+    }
+
+    bool isQuantized() const {
+        return m_is_quantized;
+    }
+
+    const QuantizedWeights& quantizedWeights() const {
+        return m_quantized_weights;
+    }
+
+    // Weight of a feature, 0 for one the model has never seen. A negated key
+    // gets the negated weight of its feature
+    float weight(const FeatureKey key) const {
+        const size_t index = find(FeatureKeys::withoutSign(key));
+        if (index == featureCount())
+            return 0.f;
+        return FeatureKeys::isNegated(key) ? -m_weights[index] : m_weights[index];
+    }
+
+    // Index of the feature in key order, featureCount() if it is absent
+    size_t find(const FeatureKey key) const {
+        if (!isValid())
+            return featureCount();
+        const size_t bucket = static_cast<size_t>(
+            FeatureKeys::mix(key) >> (64 - m_header.bucket_bits));
+        for (uint32_t i = m_bucket_starts[bucket]; i < m_bucket_starts[bucket + 1]; i++)
+            if (m_keys[i] == key)
+                return i;
+        return featureCount();
+    }
+
+    FeatureKey key(const size_t index) const {
+        return m_keys[index];
+    }
+
+    float weightAt(const size_t index) const {
+        return m_weights[index];
+    }
+
+    // Quantized, the indices of the features found are collected first and
+    // summed in one go by the integer gather kernel
+    float score(const Bitboard& board) const {
+        if (m_is_quantized) {
+            uint32_t indices[MAX_FEATURES_PER_BOARD];
+            size_t index_count = 0;
+            forEachFeatureKey(board, [this, &indices, &index_count](const FeatureKey key) {
+                const size_t index = find(FeatureKeys::withoutSign(key));
+                if (index < featureCount())
+                    indices[index_count++] = static_cast<uint32_t>(index)
+                        | (FeatureKeys::isNegated(key) ? GatherKernel::NEGATED_BIT : 0);
+            });
+            return m_quantized_weights.sum(indices, index_count);
+        }
+        float total = 0.f;
+        forEachFeatureKey(board, [this, &total](const FeatureKey key) { total += weight(key); });
+        return total;
+    }
+
+    float score(std::string_view FEN_string) const {
+        return score(Bitboard::fromFEN(FEN_string));
+    }
+
+    // Writes the score of positions[i] to scores[i]. Boards are decoded on the
+    // stack and features are looked up as they are enumerated, so nothing is
+    // allocated per position
+    void scoreBatch(const std::string_view* positions, const size_t count, float* scores) const {
+        for (size_t i = 0; i < count; i++)
+            scores[i] = score(positions[i]);
+    }
+
+    // Writes to a temporary file first so a reader never maps half a model
+    bool save(const std::string& filename) const {
+        if (!isValid())
+            return false;
+        const std::string temporary_filename = filename + ".tmp";
+        std::ofstream output(temporary_filename, std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            std::cout << "Unable to open the file: " << temporary_filename << std::endl;
+            return false;
+        }
+        output.write(reinterpret_cast<const char*>(&m_header), sizeof(Header));
+        output.write(reinterpret_cast<const char*>(m_keys), featureCount() * sizeof(FeatureKey));
+        output.write(reinterpret_cast<const char*>(m_weights), featureCount() * sizeof(float));
+        output.write(reinterpret_cast<const char*>(m_bucket_starts),
+            bucketCount(m_header) * sizeof(uint32_t));
+        output.close();
+        if (!output)
+            return false;
+
+        std::error_code error;
+        std::filesystem::rename(temporary_filename, filename, error);
+        if (error)
+            return false;
+        std::cout << "Model with " << featureCount() << " features has been written to the file: "
+            << filename << std::endl;
+        return true;
+    }
+
+private:
+    // The keys of the board as the model was trained on them
+    template <typename Callback>
+    void forEachFeatureKey(const Bitboard& board, Callback callback) const {
+        if (hasSymmetricFeatures())
+            board.forEachSymmetricFeatureKey(maxFeatureWidth(), maxFeatureHeight(), callback);
+        else
+            board.forEachFeatureKey(maxFeatureWidth(), maxFeatureHeight(), callback);
+    }
+
+    static size_t bucketCount(const Header& header) {
+        return (static_cast<size_t>(1) << header.bucket_bits) + 1;
+    }
+
+    static size_t fileSize(const Header& header) {
+        return sizeof(Header) + static_cast<size_t>(header.entry_count)
+            * (sizeof(FeatureKey) + sizeof(float)) + bucketCount(header) * sizeof(uint32_t);
+    }
+
+    Header m_header;
+    const FeatureKey* m_keys;
+    const float* m_weights;
+    const uint32_t* m_bucket_starts;
+    bool m_is_quantized;
+    QuantizedWeights m_quantized_weights;
+
+    std::vector<FeatureKey> m_owned_keys;
+    std::vector<float> m_owned_weights;
+    std::vector<uint32_t> m_owned_bucket_starts;
+    std::unique_ptr<MappedFile> m_file;
+};
@@ -0,0 +1,291 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ATOMIZER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without extra flags, GCC and Clang need the
+// instruction set enabled per function
+#if defined(ATOMIZER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ATOMIZER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ATOMIZER_TARGET(isa)
+#endif
+
+namespace CpuFeatures {
+#ifdef ATOMIZER_X86
+    static void cpuid(int registers[4], const int leaf, const int subleaf) {
+#ifdef _MSC_VER
+        __cpuidex(registers, leaf, subleaf);
+#else
+        __asm__ __volatile__("cpuid"
+            : "=a"(registers[0]), "=b"(registers[1]), "=c"(registers[2]), "=d"(registers[3])
+            : "a"(leaf), "c"(subleaf));
+#endif
+    }
+
+    // Which register states the OS saves on a context switch
+    static uint64_t enabledStateMask() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t low, high;
+        __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+    }
+
+    static bool hasOsxsave() {
+        int registers[4];
+        cpuid(registers, 1, 0);
+        return (registers[2] & (1 << 27)) != 0;
+    }
+
+    static bool hasAvx2() {
+        int registers[4];
+        cpuid(registers, 0, 0);
+        if (registers[0] < 7 || !hasOsxsave() || (enabledStateMask() & 0x6) != 0x6)
+            return false;
+        cpuid(registers, 7, 0);
+        return (registers[1] & (1 << 5)) != 0;
+    }
+
+    static bool hasAvx512f() {
+        int registers[4];
+        cpuid(registers, 0, 0);
+        if (registers[0] < 7 || !hasOsxsave() || (enabledStateMask() & 0xE6) != 0xE6)
+            return false;
+        cpuid(registers, 7, 0);
+        return (registers[1] & (1 << 16)) != 0;
+    }
+
+    static bool hasBmi2() {
+        int registers[4];
+        cpuid(registers, 0, 0);
+        if (registers[0] < 7)
+            return false;
+        cpuid(registers, 7, 0);
+        return (registers[1] & (1 << 8)) != 0;
+    }
+#else
+    static bool hasAvx2() { return false; }
+    static bool hasAvx512f() { return false; }
+    static bool hasBmi2() { return false; }
+#endif
+};
+
+// Sums weights[indices[0..count)], the inner loop of scoring a parent board.
+// The widest kernel the CPU supports is picked once, on first use.
+// The int16_t overloads sum quantized weights exactly in 32-bit lanes. Their
+// SIMD versions gather 32 bits at each weight and keep the low half, so the
+// weight array needs one readable int16_t past its last weight.
+// An index with NEGATED_BIT set adds the negated weight of the index without it
+namespace GatherKernel {
+    using SumFunction = float (*)(const float*, const uint32_t*, size_t);
+    using SumInt16Function = int32_t (*)(const int16_t*, const uint32_t*, size_t);
+
+    static constexpr uint32_t NEGATED_BIT = 1u << 31;
+    static constexpr uint32_t INDEX_MASK = NEGATED_BIT - 1;
+
+    static float sumScalar(const float* weights, const uint32_t* indices, const size_t count) {
+        float total = 0.f;
+        for (size_t i = 0; i < count; i++) {
+            const float weight = weights[indices[i] & INDEX_MASK];
+            total += (indices[i] & NEGATED_BIT) ? -weight : weight;
+        }
+        return total;
+    }
+
+    static int32_t sumScalar(const int16_t* weights, const uint32_t* indices, const size_t count) {
+        int32_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            const int32_t weight = weights[indices[i] & INDEX_MASK];
+            total += (indices[i] & NEGATED_BIT) ? -weight : weight;
+        }
+        return total;
+    }
+
+#ifdef ATOMIZER_X86
+    // Gathers the weights of 8 indices and flips the float sign bit of the
+    // negated ones, which is where NEGATED_BIT already sits
+    ATOMIZER_TARGET("avx2")
+    static __m256 signedGatherAvx2(const float* weights, const __m256i indices) {
+        const __m256 gathered = _mm256_i32gather_ps(weights,
+            _mm256_and_si256(indices, _mm256_set1_epi32(INDEX_MASK)), 4);
+        return _mm256_xor_ps(gathered, _mm256_castsi256_ps(
+            _mm256_and_si256(indices, _mm256_set1_epi32(static_cast<int>(NEGATED_BIT)))));
+    }
+
+    ATOMIZER_TARGET("avx2")
+    static float sumAvx2(const float* weights, const uint32_t* indices, const size_t count) {
+        __m256 total_a = _mm256_setzero_ps();
+        __m256 total_b = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m256i indices_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+            const __m256i indices_b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i + 8));
+            total_a = _mm256_add_ps(total_a, signedGatherAvx2(weights, indices_a));
+            total_b = _mm256_add_ps(total_b, signedGatherAvx2(weights, indices_b));
+        }
+        for (; i + 8 <= count; i += 8) {
+            const __m256i indices_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+            total_a = _mm256_add_ps(total_a, signedGatherAvx2(weights, indices_a));
+        }
+        total_a = _mm256_add_ps(total_a, total_b);
+
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(total_a), _mm256_extractf128_ps(total_a, 1));
+        const __m128 quarter = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        float total = _mm_cvtss_f32(_mm_add_ss(quarter, _mm_shuffle_ps(quarter, quarter, 1)));
+        return total + sumScalar(weights, indices + i, count - i);
+    }
+
+    // The sign flip is done on the integer side, _mm512_xor_ps needs AVX512DQ
+    ATOMIZER_TARGET("avx512f")
+    static __m512 signedGatherAvx512(const float* weights, const __m512i indices,
+        const __mmask16 lanes = 0xFFFF) {
+        const __m512 gathered = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes,
+            _mm512_and_si512(indices, _mm512_set1_epi32(INDEX_MASK)), weights, 4);
+        return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(gathered),
+            _mm512_and_si512(indices, _mm512_set1_epi32(static_cast<int>(NEGATED_BIT)))));
+    }
+
+    ATOMIZER_TARGET("avx512f")
+    static float sumAvx512(const float* weights, const uint32_t* indices, const size_t count) {
+        __m512 total_a = _mm512_setzero_ps();
+        __m512 total_b = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            const __m512i indices_a = _mm512_loadu_si512(indices + i);
+            const __m512i indices_b = _mm512_loadu_si512(indices + i + 16);
+            total_a = _mm512_add_ps(total_a, signedGatherAvx512(weights, indices_a));
+            total_b = _mm512_add_ps(total_b, signedGatherAvx512(weights, indices_b));
+        }
+        if (i + 16 <= count) {
+            const __m512i indices_a = _mm512_loadu_si512(indices + i);
+            total_a = _mm512_add_ps(total_a, signedGatherAvx512(weights, indices_a));
+            i += 16;
+        }
+        if (i < count) {
+            const __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+            const __m512i indices_a = _mm512_maskz_loadu_epi32(tail, indices + i);
+            total_a = _mm512_add_ps(total_a, signedGatherAvx512(weights, indices_a, tail));
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(total_a, total_b));
+    }
+
+    // Sign extends the low 16 bits of every 32-bit lane
+    ATOMIZER_TARGET("avx2")
+    static __m256i lowInt16Avx2(const __m256i gathered) {
+        return _mm256_srai_epi32(_mm256_slli_epi32(gathered, 16), 16);
+    }
+
+    // Gathers 8 int16 weights, negating those of negated indices as
+    // (w ^ s) - s with s all ones for them and 0 otherwise
+    ATOMIZER_TARGET("avx2")
+    static __m256i signedGatherAvx2(const int* base, const __m256i indices) {
+        const __m256i weights = lowInt16Avx2(_mm256_i32gather_epi32(base,
+            _mm256_and_si256(indices, _mm256_set1_epi32(INDEX_MASK)), 2));
+        const __m256i signs = _mm256_srai_epi32(indices, 31);
+        return _mm256_sub_epi32(_mm256_xor_si256(weights, signs), signs);
+    }
+
+    ATOMIZER_TARGET("avx2")
+    static int32_t sumAvx2(const int16_t* weights, const uint32_t* indices, const size_t count) {
+        const int* base = reinterpret_cast<const int*>(weights);
+        __m256i total_a = _mm256_setzero_si256();
+        __m256i total_b = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m256i indices_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+            const __m256i indices_b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i + 8));
+            total_a = _mm256_add_epi32(total_a, signedGatherAvx2(base, indices_a));
+            total_b = _mm256_add_epi32(total_b, signedGatherAvx2(base, indices_b));
+        }
+        for (; i + 8 <= count; i += 8) {
+            const __m256i indices_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+            total_a = _mm256_add_epi32(total_a, signedGatherAvx2(base, indices_a));
+        }
+        total_a = _mm256_add_epi32(total_a, total_b);
+
+        const __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total_a), _mm256_extracti128_si256(total_a, 1));
+        const __m128i quarter = _mm_add_epi32(half, _mm_unpackhi_epi64(half, half));
+        const int32_t total = _mm_cvtsi128_si32(_mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, 1)));
+        return total + sumScalar(weights, indices + i, count - i);
+    }
+
+    ATOMIZER_TARGET("avx512f")
+    static __m512i lowInt16Avx512(const __m512i gathered) {
+        return _mm512_srai_epi32(_mm512_slli_epi32(gathered, 16), 16);
+    }
+
+    ATOMIZER_TARGET("avx512f")
+    static __m512i signedGatherAvx512(const int* base, const __m512i indices,
+        const __mmask16 lanes = 0xFFFF) {
+        const __m512i weights = lowInt16Avx512(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(),
+            lanes, _mm512_and_si512(indices, _mm512_set1_epi32(INDEX_MASK)), base, 2));
+        const __m512i signs = _mm512_srai_epi32(indices, 31);
+        return _mm512_sub_epi32(_mm512_xor_si512(weights, signs), signs);
+    }
+
+    ATOMIZER_TARGET("avx512f")
+    static int32_t sumAvx512(const int16_t* weights, const uint32_t* indices, const size_t count) {
+        const int* base = reinterpret_cast<const int*>(weights);
+        __m512i total_a = _mm512_setzero_si512();
+        __m512i total_b = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            const __m512i indices_a = _mm512_loadu_si512(indices + i);
+            const __m512i indices_b = _mm512_loadu_si512(indices + i + 16);
+            total_a = _mm512_add_epi32(total_a, signedGatherAvx512(base, indices_a));
+            total_b = _mm512_add_epi32(total_b, signedGatherAvx512(base, indices_b));
+        }
+        if (i + 16 <= count) {
+            const __m512i indices_a = _mm512_loadu_si512(indices + i);
+            total_a = _mm512_add_epi32(total_a, signedGatherAvx512(base, indices_a));
+            i += 16;
+        }
+        if (i < count) {
+            const __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+            const __m512i indices_a = _mm512_maskz_loadu_epi32(tail, indices + i);
+            total_a = _mm512_add_epi32(total_a, signedGatherAvx512(base, indices_a, tail));
+        }
+        return _mm512_reduce_add_epi32(_mm512_add_epi32(total_a, total_b));
+    }
+#endif
+
+    static SumFunction resolve() {
+#ifdef ATOMIZER_X86
+        if (CpuFeatures::hasAvx512f())
+            return sumAvx512;
+        if (CpuFeatures::hasAvx2())
+            return sumAvx2;
+#endif
+        return sumScalar;
+    }
+
+    static float sum(const float* weights, const uint32_t* indices, const size_t count) {
+        static const SumFunction selected = resolve();
+        return selected(weights, indices, count);
+    }
+
+    static SumInt16Function resolveInt16() {
+#ifdef ATOMIZER_X86
+        if (CpuFeatures::hasAvx512f())
+            return sumAvx512;
+        if (CpuFeatures::hasAvx2())
+            return sumAvx2;
+#endif
+        return sumScalar;
+    }
+
+    static int32_t sum(const int16_t* weights, const uint32_t* indices, const size_t count) {
+        static const SumInt16Function selected = resolveInt16();
+        return selected(weights, indices, count);
+    }
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <iomanip> // For setprecision
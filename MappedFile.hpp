@@ -0,0 +1,120 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file mapped into memory
+class MappedFile {
+public:
+    MappedFile() :
+        m_data(nullptr),
+        m_size(0)
+    {
+#ifdef _WIN32
+        m_file = INVALID_HANDLE_VALUE;
+        m_mapping = nullptr;
+#else
+        m_descriptor = -1;
+#endif
+    }
+
+    MappedFile(const std::string& filename) :
+        m_data(nullptr),
+        m_size(0)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        m_mapping = nullptr;
+        if (m_file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart == 0)
+            return;
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping == nullptr)
+            return;
+
+        m_data = static_cast<const char*>(
+            MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data != nullptr)
+            m_size = static_cast<size_t>(file_size.QuadPart);
+#else
+        m_descriptor = open(filename.c_str(), O_RDONLY);
+        if (m_descriptor < 0)
+            return;
+
+        struct stat file_stat;
+        if (fstat(m_descriptor, &file_stat) != 0 || file_stat.st_size == 0)
+            return;
+
+        void* mapped = mmap(nullptr, static_cast<size_t>(file_stat.st_size),
+            PROT_READ, MAP_PRIVATE, m_descriptor, 0);
+        if (mapped == MAP_FAILED)
+            return;
+
+        madvise(mapped, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(mapped);
+        m_size = static_cast<size_t>(file_stat.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if (m_data != nullptr)
+            munmap(const_cast<char*>(m_data), m_size);
+        if (m_descriptor >= 0)
+            close(m_descriptor);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const {
+        return m_data != nullptr;
+    }
+
+    const char* data() const {
+        return m_data;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    std::string_view view() const {
+        return { m_data, m_size };
+    }
+
+private:
+    const char* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#else
+    int m_descriptor;
+#endif
+};
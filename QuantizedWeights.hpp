@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "GatherKernel.hpp"
+
+// Weights rounded to int16_t steps of one scale shared by the whole model, so
+// a score is an exact integer sum times the scale. Half the bytes of the float
+// weights for the gather to pull through the cache
+class QuantizedWeights {
+public:
+    static constexpr int32_t MAX_STEP = 32767;
+
+    // How far the quantized weights are from the float ones
+    struct Error {
+        double max_weight_error = 0.0;
+        double mean_weight_error = 0.0;
+    };
+
+    QuantizedWeights() :
+        m_values(1, 0),
+        m_scale(1.f)
+    {}
+
+    // The scale puts headroom times the largest weight at MAX_STEP. Weights
+    // that are still being trained want some headroom, so update keeps
+    // working as they grow; all zero weights get a range of 1
+    void quantize(const std::vector<float>& weights, const float headroom = 1.f) {
+        float max_magnitude = 0.f;
+        for (const float weight : weights)
+            max_magnitude = std::max(max_magnitude, std::fabs(weight));
+        m_scale = (max_magnitude > 0.f ? max_magnitude * headroom : 1.f) / MAX_STEP;
+        // One spare value at the end for the SIMD gathers
+        m_values.assign(weights.size() + 1, 0);
+        for (size_t i = 0; i < weights.size(); i++)
+            m_values[i] = toStep(weights[i]);
+    }
+
+    // Requantizes a single weight. False if it no longer fits the scale, the
+    // caller then has to quantize everything again
+    bool update(const size_t index, const float weight) {
+        if (std::fabs(weight) > m_scale * MAX_STEP)
+            return false;
+        m_values[index] = toStep(weight);
+        return true;
+    }
+
+    // Requantizes a single weight at the current scale, saturating at
+    // MAX_STEP instead of asking for a new scale
+    void set(const size_t index, const float weight) {
+        m_values[index] = toStep(weight);
+    }
+
+    // set for every weight, the scale stays as it is
+    void requantize(const std::vector<float>& weights) {
+        for (size_t i = 0; i < weights.size(); i++)
+            m_values[i] = toStep(weights[i]);
+    }
+
+    // What adding weight_delta to weight changes its quantized value by
+    float stepDelta(const float weight, const float weight_delta) const {
+        return static_cast<float>(toStep(weight + weight_delta) - toStep(weight)) * m_scale;
+    }
+
+    size_t size() const {
+        return m_values.size() - 1;
+    }
+
+    float scale() const {
+        return m_scale;
+    }
+
+    const int16_t* data() const {
+        return m_values.data();
+    }
+
+    float weight(const size_t index) const {
+        return m_values[index] * m_scale;
+    }
+
+    float sum(const uint32_t* indices, const size_t count) const {
+        return static_cast<float>(GatherKernel::sum(m_values.data(), indices, count)) * m_scale;
+    }
+
+    size_t memoryBytes() const {
+        return m_values.capacity() * sizeof(int16_t);
+    }
+
+    Error error(const std::vector<float>& weights) const {
+        Error result;
+        for (size_t i = 0; i < std::min(weights.size(), size()); i++) {
+            const double weight_error = std::fabs(static_cast<double>(weights[i]) - weight(i));
+            result.max_weight_error = std::max(result.max_weight_error, weight_error);
+            result.mean_weight_error += weight_error;
+        }
+        if (size() > 0)
+            result.mean_weight_error /= size();
+        return result;
+    }
+
+private:
+    int16_t toStep(const float weight) const {
+        const long step = std::lround(weight / m_scale);
+        return static_cast<int16_t>(std::clamp<long>(step, -MAX_STEP, MAX_STEP));
+    }
+
+    std::vector<int16_t> m_values;
+    float m_scale;
+};
@@ -1,57 +1,167 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
+// Path compressed trie over the 13 board characters. Nodes, edge labels and
+// child lists live in three arrays and refer to each other by 32-bit index, so
+// there is no per node allocation and the whole tree is freed at once.
+// A node only stores the children it has: the bits of child_mask say which
+// characters are present and a child's slot is the count of set bits below it
 class RadixTree {
 private:
+    static constexpr uint32_t ALPHABET_SIZE = 13;
+    static constexpr uint32_t ROOT = 0;
+
     struct Node {
+        uint32_t label_begin;   // Edge label from the parent into m_labels
+        uint32_t label_length;
+        uint32_t first_child;   // Child list into m_children
+        uint16_t child_mask;
         bool is_end;
         size_t value;
-        Node* child[13];  // Reduced to 13 for the characters you need
-        Node() : is_end(false), value(0) {
-            for (int i = 0; i < 13; i++) {
-                child[i] = nullptr;
-            }
-        }
-        ~Node() {
-            for (auto& c : child)
-                delete c;
-        }
     };
 
-    Node* root;
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_children;
+    std::string m_labels;
 
 public:
-    RadixTree() : root(new Node()) {}
-
-    ~RadixTree() { delete root; }
+    RadixTree() {
+        clear();
+    }
 
-    void insert(const std::string& word, size_t value) {
-        Node* curr = root;
-        for (char c : word) {
-            int idx = get_index(c);
-            if (curr->child[idx] == nullptr) {
-                curr->child[idx] = new Node();
+    void insert(std::string_view word, size_t value) {
+        uint32_t curr = ROOT;
+        size_t position = 0;
+        while (position < word.size()) {
+            const uint32_t idx = get_index(word[position]);
+            const uint32_t child = find_child(curr, idx);
+            if (child == ROOT) {
+                // The rest of the word becomes one edge
+                const uint32_t leaf = new_node(word.substr(position));
+                add_child(curr, idx, leaf);
+                curr = leaf;
+                position = word.size();
+                break;
             }
-            curr = curr->child[idx];
+
+            const size_t matched = match_label(child, word.substr(position));
+            if (matched < m_nodes[child].label_length)
+                split(child, static_cast<uint32_t>(matched));
+            curr = child;
+            position += matched;
         }
-        curr->is_end = true;
-        curr->value = value;
+        m_nodes[curr].is_end = true;
+        m_nodes[curr].value = value;
     }
 
-    std::pair<bool, size_t> search(const std::string& word) const {
-        Node* curr = root;
-        for (char c : word) {
-            int idx = get_index(c);
-            if (curr->child[idx] == nullptr) {
+    std::pair<bool, size_t> search(std::string_view word) const {
+        uint32_t curr = ROOT;
+        size_t position = 0;
+        while (position < word.size()) {
+            const uint32_t child = find_child(curr, get_index(word[position]));
+            if (child == ROOT)
                 return { false, 0 };
-            }
-            curr = curr->child[idx];
+            const Node& node = m_nodes[child];
+            if (word.size() - position < node.label_length
+                || word.compare(position, node.label_length,
+                    m_labels, node.label_begin, node.label_length) != 0)
+                return { false, 0 };
+            curr = child;
+            position += node.label_length;
         }
-        return { curr->is_end, curr->value };
+        return { m_nodes[curr].is_end, m_nodes[curr].value };
+    }
+
+    void clear() {
+        m_nodes.assign(1, Node{ 0, 0, 0, 0, false, 0 });
+        m_children.clear();
+        m_labels.clear();
+    }
+
+    size_t nodeCount() const {
+        return m_nodes.size();
+    }
+
+    size_t memoryBytes() const {
+        return m_nodes.capacity() * sizeof(Node)
+            + m_children.capacity() * sizeof(uint32_t)
+            + m_labels.capacity();
     }
 
 private:
+    static uint32_t popcount(uint32_t bits) {
+        bits = bits - ((bits >> 1) & 0x55555555u);
+        bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+        return (((bits + (bits >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+    }
+
+    // Slot of character idx among the node's children
+    static uint32_t child_slot(const uint16_t child_mask, const uint32_t idx) {
+        return popcount(child_mask & ((1u << idx) - 1));
+    }
+
+    // ROOT when there is no such child, the root is never anyone's child
+    uint32_t find_child(const uint32_t node_index, const uint32_t idx) const {
+        const Node& node = m_nodes[node_index];
+        if ((node.child_mask & (1u << idx)) == 0)
+            return ROOT;
+        return m_children[node.first_child + child_slot(node.child_mask, idx)];
+    }
+
+    uint32_t new_node(std::string_view label) {
+        m_nodes.push_back(Node{ static_cast<uint32_t>(m_labels.size()),
+            static_cast<uint32_t>(label.size()), 0, 0, false, 0 });
+        m_labels.append(label);
+        return static_cast<uint32_t>(m_nodes.size() - 1);
+    }
+
+    size_t match_label(const uint32_t node_index, std::string_view word) const {
+        const Node& node = m_nodes[node_index];
+        size_t matched = 0;
+        while (matched < node.label_length && matched < word.size()
+            && m_labels[node.label_begin + matched] == word[matched])
+            matched++;
+        return matched;
+    }
+
+    // Child lists are copied to the end of m_children when they grow. The old
+    // list is left behind, at most 12 + 11 + ... + 1 dead slots per node
+    void add_child(const uint32_t node_index, const uint32_t idx, const uint32_t child) {
+        const Node node = m_nodes[node_index];
+        const uint32_t child_count = popcount(node.child_mask);
+        const uint32_t slot = child_slot(node.child_mask, idx);
+        const uint32_t first_child = static_cast<uint32_t>(m_children.size());
+        for (uint32_t i = 0; i < slot; i++)
+            m_children.push_back(m_children[node.first_child + i]);
+        m_children.push_back(child);
+        for (uint32_t i = slot; i < child_count; i++)
+            m_children.push_back(m_children[node.first_child + i]);
+
+        m_nodes[node_index].first_child = first_child;
+        m_nodes[node_index].child_mask = static_cast<uint16_t>(node.child_mask | (1u << idx));
+    }
+
+    // Cuts the edge into node after length characters. The node keeps its
+    // index, so its parent's child list stays valid, and becomes the prefix;
+    // a new node takes over the remainder with everything below it
+    void split(const uint32_t node_index, const uint32_t length) {
+        const Node node = m_nodes[node_index];
+        m_nodes.push_back(Node{ node.label_begin + length, node.label_length - length,
+            node.first_child, node.child_mask, node.is_end, node.value });
+        const uint32_t suffix = static_cast<uint32_t>(m_nodes.size() - 1);
+
+        m_nodes[node_index] = Node{ node.label_begin, length,
+            static_cast<uint32_t>(m_children.size()), 0, false, 0 };
+        const uint32_t idx = get_index(m_labels[node.label_begin + length]);
+        m_nodes[node_index].child_mask = static_cast<uint16_t>(1u << idx);
+        m_children.push_back(suffix);
+    }
+
     static uint8_t get_index(char c) {
         switch (c) {
         case 'P': return 0;
@@ -71,4 +181,4 @@ private:
         default: throw std::out_of_range("Invalid character");
         }
     }
-};
\ No newline at end of file
+};
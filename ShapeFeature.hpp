@@ -7,6 +7,7 @@
 
 #include "Utility.hpp"
 #include "GeometricProperties.hpp"
+#include "FeatureKey.hpp"
 
 class ShapeFeature {
 private:
@@ -50,7 +51,7 @@ public:
         return m_geometric_properties.offset_y();
     }
 
-    const auto charSequence() const {
+    const std::vector<char>& charSequence() const {
         return m_char_sequence;
     }
 
@@ -136,12 +137,20 @@ public:
         return serialized;
     }
 
+    FeatureKey packedKey() const {
+        return FeatureKeys::pack(shapeType(), width(), height(),
+            offset_x(), offset_y(), m_char_sequence);
+    }
+
     // Todo : Refactor this, it's fucking trash
-    const std::vector<ShapeFeature> decomposeIntoSubquadrillaterals() const {
+    // Bitboard::forEachFeatureKey is the fast path, this one stays as the reference
+    const std::vector<ShapeFeature> decomposeIntoSubquadrillaterals(
+        const size_t max_width = 1, const size_t max_height = 1) const {
         std::vector<ShapeFeature> shape_feature_list;
         for (size_t w = width(); w >= 1; --w) {
             for (size_t h = height(); h >= 1; --h) {
-                if (w < 2 && h < 2) {
+                if (w <= max_width && h <= max_height
+                    && !(w == width() && h == height())) { // Exclude self
                 for (size_t y1 = 0; y1 <= height() - h; ++y1) {
                     for (size_t x1 = 0; x1 <= width() - w; ++x1) {
                         std::vector<char> subrect_data;
@@ -162,7 +171,6 @@ public:
             }
         }
 
-        shape_feature_list.erase(shape_feature_list.begin()); // Exclude self
         return shape_feature_list;
     }
 };
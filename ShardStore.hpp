@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CompressedSparseRows.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// A run of parents as the trainer sees them: the known score of each parent
+// and the features it contains, as rows of feature indices
+struct Shard {
+    std::vector<float> expected_scores;
+    CompressedSparseRows rows;
+
+    size_t memoryBytes() const {
+        return expected_scores.capacity() * sizeof(float) + rows.memoryBytes();
+    }
+};
+
+// Parents that don't fit in memory, kept as numbered shard files in a
+// directory the store owns. Each file is a Header, float[parent_count] expected scores and
+// the rows as written by CompressedSparseRows::write. The files only live as
+// long as the store, they are rebuilt from the dataset by every run
+class ShardStore {
+public:
+    static constexpr char MAGIC[8] = { 'A', 'T', 'M', 'Z', 'S', 'H', 'R', 'D' };
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t parent_count;
+        uint64_t entry_count;
+    };
+
+    static_assert(sizeof(Header) == 32, "Header layout is part of the file format");
+    static_assert(sizeof(size_t) == 8, "Row offsets are stored as 64-bit values");
+
+    // A directory under the system's temp directory that no other store, in
+    // this process or another, uses. The store deletes it when it's done
+    static std::string uniqueDirectory(const std::string& name) {
+        static std::atomic<size_t> store_count(0);
+#ifdef _WIN32
+        const long long process_id = _getpid();
+#else
+        const long long process_id = getpid();
+#endif
+        std::error_code error;
+        std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+        if (error)
+            directory = ".";
+        return (directory / (name + "-" + std::to_string(process_id) + "-"
+            + std::to_string(store_count.fetch_add(1)))).string();
+    }
+
+    ShardStore(const std::string& directory) :
+        m_directory(directory),
+        m_parent_count(0)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(m_directory, error);
+        if (error)
+            std::cout << "Unable to create the directory: " << m_directory << std::endl;
+    }
+
+    ~ShardStore() {
+        std::error_code error;
+        std::filesystem::remove_all(m_directory, error);
+    }
+
+    ShardStore(const ShardStore&) = delete;
+    ShardStore& operator=(const ShardStore&) = delete;
+
+    size_t shardCount() const {
+        return m_shard_parent_counts.size();
+    }
+
+    size_t parentCount() const {
+        return m_parent_count;
+    }
+
+    size_t shardParentCount(const size_t shard_index) const {
+        return m_shard_parent_counts[shard_index];
+    }
+
+    std::string path(const size_t shard_index) const {
+        return (std::filesystem::path(m_directory)
+            / ("Shard" + std::to_string(shard_index) + ".bin")).string();
+    }
+
+    // Appends the shard as the next file
+    bool write(const Shard& shard) {
+        const std::string filename = path(shardCount());
+        std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            std::cout << "Unable to open the file: " << filename << std::endl;
+            return false;
+        }
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.parent_count = shard.expected_scores.size();
+        header.entry_count = shard.rows.entryCount();
+        output.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        output.write(reinterpret_cast<const char*>(shard.expected_scores.data()),
+            shard.expected_scores.size() * sizeof(float));
+        shard.rows.write(output);
+        output.close();
+        if (!output) {
+            std::cout << "Unable to write the file: " << filename << std::endl;
+            return false;
+        }
+
+        m_shard_parent_counts.push_back(shard.expected_scores.size());
+        m_parent_count += shard.expected_scores.size();
+        return true;
+    }
+
+    bool read(const size_t shard_index, Shard& shard) const {
+        std::ifstream input(path(shard_index), std::ios::binary);
+        Header header;
+        if (!input.read(reinterpret_cast<char*>(&header), sizeof(Header))
+            || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION)
+            return false;
+
+        shard.expected_scores.resize(static_cast<size_t>(header.parent_count));
+        input.read(reinterpret_cast<char*>(shard.expected_scores.data()),
+            shard.expected_scores.size() * sizeof(float));
+        return shard.rows.read(input, static_cast<size_t>(header.parent_count),
+            static_cast<size_t>(header.entry_count));
+    }
+
+private:
+    std::string m_directory;
+    std::vector<size_t> m_shard_parent_counts;
+    size_t m_parent_count;
+};
+
+// Hands out the shards of a store in the given order while a reader thread
+// loads up to read_ahead of the following ones, so training overlaps with
+// the disk. Feature indices are rewritten through remapped_columns on the
+// reader thread, the same way pruning rewrites the in-memory rows
+class ShardStream {
+public:
+    ShardStream(const ShardStore& store, const std::vector<size_t>& shard_order,
+        const std::vector<size_t>& remapped_columns, const size_t read_ahead) :
+        m_store(store),
+        m_shard_order(shard_order),
+        m_remapped_columns(remapped_columns),
+        m_read_ahead(std::max<size_t>(read_ahead, 1)),
+        m_next_to_load(0),
+        m_failed(false),
+        m_stopping(false),
+        m_reader([this]() { readerLoop(); })
+    {}
+
+    ~ShardStream() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_changed.notify_all();
+        m_reader.join();
+    }
+
+    ShardStream(const ShardStream&) = delete;
+    ShardStream& operator=(const ShardStream&) = delete;
+
+    // Waits for the next shard. False once every shard was handed out or a
+    // file could not be read
+    bool next(Shard& shard) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() {
+            return !m_loaded.empty() || m_failed || m_next_to_load == m_shard_order.size();
+        });
+        if (m_loaded.empty())
+            return false;
+        shard = std::move(m_loaded.front());
+        m_loaded.pop_front();
+        lock.unlock();
+        m_changed.notify_all();
+        return true;
+    }
+
+    // Whether next stopped early because a file could not be read, rather
+    // than because every shard was handed out
+    bool failed() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed;
+    }
+
+private:
+    void readerLoop() {
+        while (true) {
+            size_t shard_index;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_changed.wait(lock, [this]() {
+                    return m_stopping || m_loaded.size() < m_read_ahead;
+                });
+                if (m_stopping || m_next_to_load == m_shard_order.size())
+                    return;
+                shard_index = m_shard_order[m_next_to_load];
+            }
+
+            Shard shard;
+            const bool success = m_store.read(shard_index, shard);
+            if (success && !m_remapped_columns.empty())
+                shard.rows.remapColumns(m_remapped_columns);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (success)
+                    m_loaded.push_back(std::move(shard));
+                else
+                    m_failed = true;
+                m_next_to_load++;
+            }
+            m_changed.notify_all();
+            if (!success) {
+                std::cout << "Unable to read the file: " << m_store.path(shard_index) << std::endl;
+                return;
+            }
+        }
+    }
+
+    const ShardStore& m_store;
+    std::vector<size_t> m_shard_order;
+    const std::vector<size_t>& m_remapped_columns;
+    size_t m_read_ahead;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<Shard> m_loaded;
+    size_t m_next_to_load;
+    bool m_failed;
+    bool m_stopping;
+    std::thread m_reader;
+};
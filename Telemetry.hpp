@@ -0,0 +1,246 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#elif defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters summed over every thread of the process that exists when
+// open is called, so workers of a ThreadPool created earlier are included.
+// Only Linux has them, elsewhere or when the kernel refuses (e.g. a high
+// perf_event_paranoid) isOpen stays false and readings are zero
+class PerfCounters {
+public:
+    struct Reading {
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cache_misses = 0;
+    };
+
+    PerfCounters() {}
+
+    ~PerfCounters() {
+        close();
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isOpen() const {
+        return !m_groups.empty();
+    }
+
+    void open() {
+        close();
+#ifdef __linux__
+        DIR* task_directory = opendir("/proc/self/task");
+        if (task_directory == nullptr)
+            return;
+        while (const dirent* entry = readdir(task_directory)) {
+            const int thread_id = std::atoi(entry->d_name);
+            if (thread_id <= 0)
+                continue;
+            Group group;
+            group.cycles = openCounter(PERF_COUNT_HW_CPU_CYCLES, thread_id, -1);
+            if (group.cycles < 0)
+                continue;
+            group.instructions = openCounter(PERF_COUNT_HW_INSTRUCTIONS, thread_id, group.cycles);
+            group.cache_misses = openCounter(PERF_COUNT_HW_CACHE_MISSES, thread_id, group.cycles);
+            m_groups.push_back(group);
+        }
+        closedir(task_directory);
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        for (const Group& group : m_groups) {
+            ioctl(group.cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(group.cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    Reading stop() {
+        Reading reading;
+#ifdef __linux__
+        for (const Group& group : m_groups) {
+            ioctl(group.cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            // PERF_FORMAT_GROUP: the member count, then one value per member
+            // in the order they were opened
+            uint64_t values[4] = { 0, 0, 0, 0 };
+            if (read(group.cycles, values, sizeof(values)) < static_cast<ssize_t>(2 * sizeof(uint64_t)))
+                continue;
+            size_t member = 1;
+            reading.cycles += values[member++];
+            if (group.instructions >= 0 && member <= values[0])
+                reading.instructions += values[member++];
+            if (group.cache_misses >= 0 && member <= values[0])
+                reading.cache_misses += values[member++];
+        }
+#endif
+        return reading;
+    }
+
+private:
+    struct Group {
+        int cycles = -1;
+        int instructions = -1;
+        int cache_misses = -1;
+    };
+
+#ifdef __linux__
+    static int openCounter(const uint64_t config, const int thread_id, const int group_leader) {
+        perf_event_attr attributes{};
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(perf_event_attr);
+        attributes.config = config;
+        attributes.disabled = group_leader < 0 ? 1 : 0;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attributes, thread_id, -1, group_leader, 0));
+    }
+#endif
+
+    void close() {
+#ifdef __linux__
+        for (const Group& group : m_groups)
+            for (const int descriptor : { group.cache_misses, group.instructions, group.cycles })
+                if (descriptor >= 0)
+                    ::close(descriptor);
+#endif
+        m_groups.clear();
+    }
+
+    std::vector<Group> m_groups;
+};
+
+// Training progress as JSON lines, one object per event, so runs can be
+// compared with a script instead of by reading the console. Every record
+// gets the event name and the seconds since the Telemetry was created
+class Telemetry {
+public:
+    class Record {
+    public:
+        Record(std::string_view event) :
+            m_text("{\"event\":\"")
+        {
+            m_text += event;
+            m_text += '"';
+        }
+
+        Record& field(std::string_view name, const double value) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return raw(name, buffer);
+        }
+
+        Record& field(std::string_view name, const uint64_t value) {
+            return raw(name, std::to_string(value));
+        }
+
+        Record& field(std::string_view name, std::string_view value) {
+            return raw(name, '"' + std::string(value) + '"');
+        }
+
+        const std::string& text() const {
+            return m_text;
+        }
+
+    private:
+        Record& raw(std::string_view name, const std::string& value) {
+            m_text += ",\"";
+            m_text += name;
+            m_text += "\":";
+            m_text += value;
+            return *this;
+        }
+
+        std::string m_text;
+    };
+
+    Telemetry() :
+        m_start(std::chrono::steady_clock::now())
+    {}
+
+    // Appends, so consecutive runs end up in one file, each starting with a run_start record
+    bool open(const std::string& filename) {
+        m_output.open(filename, std::ios::app);
+        if (!m_output.is_open())
+            return false;
+        write(Record("run_start"));
+        return true;
+    }
+
+    bool isOpen() const {
+        return m_output.is_open();
+    }
+
+    double elapsedSeconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    // Buffered, lines reach the disk when the buffer fills or on flush
+    void write(const Record& record) {
+        if (!m_output.is_open())
+            return;
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.6f", elapsedSeconds());
+        m_output << record.text() << ",\"time\":" << buffer << "}\n";
+    }
+
+    // One record for a finished phase of the run
+    void phase(std::string_view name, const double seconds) {
+        write(Record("phase").field("phase", name).field("seconds", seconds)
+            .field("resident_bytes", static_cast<uint64_t>(residentMemoryBytes())));
+        flush();
+    }
+
+    void flush() {
+        if (m_output.is_open())
+            m_output.flush();
+    }
+
+    // Resident set size of the whole process, 0 where it can't be read
+    static size_t residentMemoryBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return counters.WorkingSetSize;
+        return 0;
+#elif defined(__linux__)
+        std::ifstream statm("/proc/self/statm");
+        size_t total_pages = 0, resident_pages = 0;
+        if (statm >> total_pages >> resident_pages)
+            return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return 0;
+#else
+        return 0;
+#endif
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    std::ofstream m_output;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Workers that stay alive between calls, so a training round only pays for a
+// wake-up instead of thread creation. The calling thread takes part too
+class ThreadPool {
+public:
+    ThreadPool(const size_t thread_count) :
+        m_task(nullptr),
+        m_task_count(0),
+        m_next_task(0),
+        m_busy_workers(0),
+        m_generation(0),
+        m_stopping(false)
+    {
+        for (size_t i = 1; i < thread_count; i++)
+            m_workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_work_ready.notify_all();
+        for (std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t threadCount() const {
+        return m_workers.size() + 1;
+    }
+
+    // Runs task(i) for every i in [0, task_count) and returns once all are done.
+    // Which thread runs which index is not fixed, so callers that need a
+    // reproducible result write per-index outputs and combine them in order
+    void parallelFor(const size_t task_count, const std::function<void(size_t)>& task) {
+        if (m_workers.empty() || task_count <= 1) {
+            for (size_t i = 0; i < task_count; i++)
+                task(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &task;
+            m_task_count = task_count;
+            m_next_task = 0;
+            m_busy_workers = m_workers.size();
+            m_generation++;
+        }
+        m_work_ready.notify_all();
+
+        runTasks(task, task_count);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_work_done.wait(lock, [this]() { return m_busy_workers == 0; });
+        m_task = nullptr;
+    }
+
+private:
+    void runTasks(const std::function<void(size_t)>& task, const size_t task_count) {
+        for (size_t i = m_next_task++; i < task_count; i = m_next_task++)
+            task(i);
+    }
+
+    void workerLoop() {
+        size_t seen_generation = 0;
+        while (true) {
+            const std::function<void(size_t)>* task;
+            size_t task_count;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work_ready.wait(lock, [this, seen_generation]() {
+                    return m_stopping || m_generation != seen_generation;
+                });
+                if (m_stopping)
+                    return;
+                seen_generation = m_generation;
+                task = m_task;
+                task_count = m_task_count;
+            }
+
+            runTasks(*task, task_count);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_busy_workers--;
+            }
+            m_work_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_work_ready;
+    std::condition_variable m_work_done;
+    const std::function<void(size_t)>* m_task;
+    size_t m_task_count;
+    std::atomic<size_t> m_next_task;
+    size_t m_busy_workers;
+    size_t m_generation;
+    bool m_stopping;
+};
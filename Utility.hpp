@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -6,6 +7,9 @@
 #include <immintrin.h>
 #include <thread>
 #include <stdexcept>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 #include "Xoshiro.hpp"
 
@@ -55,6 +59,42 @@ namespace Utility {
         return ((n + 7) / 8) * 8;
     }
 
+    // Runs produce(i) for every chunk on thread_count worker threads while the
+    // calling thread runs consume(i) strictly in chunk order as chunks finish
+    template <typename Produce, typename Consume>
+    static void processChunksInOrder(const size_t chunk_count, const size_t thread_count,
+        Produce produce, Consume consume) {
+        std::vector<bool> ready(chunk_count, false);
+        std::atomic<size_t> next_chunk{ 0 };
+        std::mutex chunk_mutex;
+        std::condition_variable chunk_ready;
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < std::max<size_t>(thread_count, 1); t++) {
+            workers.emplace_back([&]() {
+                for (size_t i = next_chunk++; i < chunk_count; i = next_chunk++) {
+                    produce(i);
+                    {
+                        std::lock_guard<std::mutex> lock(chunk_mutex);
+                        ready[i] = true;
+                    }
+                    chunk_ready.notify_all();
+                }
+            });
+        }
+
+        for (size_t i = 0; i < chunk_count; i++) {
+            {
+                std::unique_lock<std::mutex> lock(chunk_mutex);
+                chunk_ready.wait(lock, [&ready, i]() { return ready[i]; });
+            }
+            consume(i);
+        }
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
     static size_t charToDigit(const char c) {
         if (c < '0' || c > '9')
             throw std::invalid_argument("Character was not a digit in range [0, 9]");
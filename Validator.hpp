@@ -0,0 +1,171 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CompressedSparseRows.hpp"
+#include "GatherKernel.hpp"
+
+// Scores held-out parents against snapshots of the weights on its own
+// thread, and flags when the validation error has stopped improving.
+// Handing over a snapshot never takes a lock: the trainer fills the pending
+// buffer only while the validation thread isn't holding one, otherwise the
+// snapshot is skipped
+class Validator {
+public:
+    struct Result {
+        size_t round;
+        double error;
+    };
+
+    // expected_scores are the clamped targets. patience is the number of
+    // snapshots without a relative improvement of min_improvement before
+    // shouldStop turns true, 0 never stops
+    Validator(CompressedSparseRows&& rows, std::vector<float>&& expected_scores,
+        const size_t patience, const double min_improvement) :
+        m_rows(std::move(rows)),
+        m_expected_scores(std::move(expected_scores)),
+        m_patience(patience),
+        m_min_improvement(min_improvement),
+        m_pending_round(0),
+        m_has_pending(false),
+        m_stopping(false),
+        m_should_stop(false),
+        m_best_error(std::numeric_limits<double>::max()),
+        m_best_round(0),
+        m_stale_count(0),
+        m_validator([this]() { validationLoop(); })
+    {}
+
+    ~Validator() {
+        finish();
+    }
+
+    Validator(const Validator&) = delete;
+    Validator& operator=(const Validator&) = delete;
+
+    size_t parentCount() const {
+        return m_expected_scores.size();
+    }
+
+    // Mean absolute error of the held-out parents under weights
+    double score(const std::vector<float>& weights) const {
+        double error = 0.0;
+        for (size_t i = 0; i < parentCount(); i++) {
+            const CompressedSparseRows::Row features = m_rows.row(i);
+            error += std::fabs(GatherKernel::sum(weights.data(), features.data(), features.size())
+                - m_expected_scores[i]);
+        }
+        return parentCount() > 0 ? error / parentCount() : 0.0;
+    }
+
+    // Copies the weights for the validation thread. False when it is still
+    // busy with the previous snapshot, in which case this one is dropped
+    bool submit(const size_t round, const std::vector<float>& weights) {
+        if (m_has_pending.load(std::memory_order_acquire) || m_stopping.load())
+            return false;
+        m_pending_weights.assign(weights.begin(), weights.end());
+        m_pending_round = round;
+        m_has_pending.store(true, std::memory_order_release);
+        m_pending_ready.notify_one();
+        return true;
+    }
+
+    bool shouldStop() const {
+        return m_should_stop.load(std::memory_order_relaxed);
+    }
+
+    // Results scored since the last call, in round order
+    std::vector<Result> takeResults() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<Result> results;
+        results.swap(m_results);
+        return results;
+    }
+
+    // Scores a pending snapshot and stops the thread. The best snapshot is
+    // only safe to read after this
+    void finish() {
+        if (!m_validator.joinable())
+            return;
+        m_stopping.store(true);
+        m_pending_ready.notify_one();
+        m_validator.join();
+    }
+
+    double bestError() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_best_error;
+    }
+
+    size_t bestRound() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_best_round;
+    }
+
+    const std::vector<float>& bestWeights() const {
+        return m_best_weights;
+    }
+
+private:
+    // submit notifies without the lock, so the wait is timed to pick up a
+    // snapshot whose notification came just before it started
+    static constexpr std::chrono::milliseconds POLL_INTERVAL{ 20 };
+
+    void validationLoop() {
+        std::vector<float> weights;
+        while (true) {
+            if (!m_has_pending.load(std::memory_order_acquire)) {
+                if (m_stopping.load())
+                    return;
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_pending_ready.wait_for(lock, POLL_INTERVAL, [this]() {
+                    return m_has_pending.load(std::memory_order_acquire) || m_stopping.load();
+                });
+                continue;
+            }
+
+            weights.swap(m_pending_weights);
+            const size_t round = m_pending_round;
+            m_has_pending.store(false, std::memory_order_release);
+
+            const double error = score(weights);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_results.push_back(Result{ round, error });
+            if (error < m_best_error * (1.0 - m_min_improvement)) {
+                m_best_error = error;
+                m_best_round = round;
+                m_best_weights = weights;
+                m_stale_count = 0;
+            }
+            else if (m_patience > 0 && ++m_stale_count >= m_patience) {
+                m_should_stop.store(true, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    CompressedSparseRows m_rows;
+    std::vector<float> m_expected_scores;
+    size_t m_patience;
+    double m_min_improvement;
+
+    std::vector<float> m_pending_weights;
+    size_t m_pending_round;
+    std::atomic<bool> m_has_pending;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_should_stop;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_pending_ready;
+    std::vector<Result> m_results;
+    double m_best_error;
+    size_t m_best_round;
+    std::vector<float> m_best_weights;
+    size_t m_stale_count;
+
+    std::thread m_validator;
+};
@@ -1,8 +1,12 @@
 #pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
 
 class Xoshiro {
 public:
     using result_type = float;
+    using State = std::array<uint64_t, 4>;
 
     Xoshiro(result_type seed) {
         s[0] = splitmix64(seed);
@@ -27,8 +31,47 @@ public:
         return static_cast<result_type>(result_starstar) / UINT64_T_LIMIT;
     }
 
-private:
+    State state() const {
+        return { s[0], s[1], s[2], s[3] };
+    }
+
+    // Restores a state saved by state(), e.g. from a checkpoint
+    void state(const State& state) {
+        for (int i = 0; i < 4; i++)
+            s[i] = state[i];
+    }
+
+    // Advances the state by 2^128 calls, giving a non-overlapping stream
+    void jump() {
+        static constexpr uint64_t JUMP[] = {
+            0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+        applyJumpPolynomial(JUMP);
+    }
+
+    // Advances the state by 2^192 calls, for splitting between groups of streams
+    void longJump() {
+        static constexpr uint64_t LONG_JUMP[] = {
+            0x76e15d3efefdcbbf, 0xc5004e441c522fb3, 0x77710069854ee241, 0x39109bb02acbe635 };
+        applyJumpPolynomial(LONG_JUMP);
+    }
 
+private:
+    void applyJumpPolynomial(const uint64_t polynomial[4]) {
+        uint64_t jumped[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++) {
+            for (int b = 0; b < 64; b++) {
+                if (polynomial[i] & (uint64_t(1) << b)) {
+                    jumped[0] ^= s[0];
+                    jumped[1] ^= s[1];
+                    jumped[2] ^= s[2];
+                    jumped[3] ^= s[3];
+                }
+                (*this)();
+            }
+        }
+        for (int i = 0; i < 4; i++)
+            s[i] = jumped[i];
+    }
 
     static uint64_t rotl(const uint64_t x, int k) {
         return (x << k) | (x >> (64 - k));